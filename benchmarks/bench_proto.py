@@ -0,0 +1,112 @@
+#!/usr/bin/env python3
+# Copyright 2018 The MLPerf Authors. All Rights Reserved.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+# =============================================================================
+
+"""Compare the client-server connection implementations (`--transport`) over
+loopback TCP:
+* latency: round trips of short commands, like the "time" command used by the
+  time synchronization;
+* throughput: `send_file()` to `recv_file()`, like uploading the loadgen logs.
+
+The peer runs in a separate process and uses the same transport.
+"""
+
+import argparse
+import multiprocessing
+import os
+import socket
+import sys
+import tempfile
+import time
+
+sys.path.insert(1, os.path.join(os.path.dirname(__file__), ".."))
+
+from ptd_client_server.lib import common  # noqa
+
+
+def peer(transport: str, listener: socket.socket, tmp: str) -> None:
+    conn, _ = listener.accept()
+    p = common.TRANSPORTS[transport](conn)
+    while True:
+        cmd = p.recv()
+        if cmd is None or cmd == "done":
+            break
+        if cmd == "upload":
+            p.recv_file(os.path.join(tmp, "upload.bin"))
+            p.send("OK")
+        else:
+            p.send(str(time.time()))
+    p._close()
+
+
+def bench(transport: str, round_trips: int, size: int, tmp: str) -> None:
+    listener = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+    listener.bind(("127.0.0.1", 0))
+    listener.listen(1)
+    process = multiprocessing.Process(target=peer, args=(transport, listener, tmp))
+    process.start()
+
+    s = socket.create_connection(listener.getsockname())
+    p = common.TRANSPORTS[transport](s)
+
+    time_start = time.monotonic()
+    for _ in range(round_trips):
+        p.command("time")
+    latency = (time.monotonic() - time_start) / round_trips
+
+    time_start = time.monotonic()
+    p.send("upload")
+    p.send_file(os.path.join(tmp, "data.bin"))
+    assert p.recv() == "OK"
+    throughput = size / (time.monotonic() - time_start)
+
+    p.send("done")
+    process.join()
+    p._close()
+    listener.close()
+
+    print(
+        f"{transport:<8} latency {latency * 1e6:8.1f} us"
+        f"  throughput {throughput / 1e6:8.1f} MB/s"
+    )
+
+
+def main() -> None:
+    parser = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+    # fmt: off
+    parser.add_argument(
+        "--round-trips", metavar="N", type=int, default=10000,
+        help="number of commands for the latency test, defaults to 10000")
+    parser.add_argument(
+        "--size-mb", metavar="N", type=int, default=1024,
+        help="size of the uploaded file, defaults to 1024")
+    parser.add_argument(
+        "--dir", metavar="DIR", type=str, default=None,
+        help="directory for temporary files")
+    # fmt: on
+    args = parser.parse_args()
+
+    size = args.size_mb * 1000 * 1000
+    with tempfile.TemporaryDirectory(dir=args.dir) as tmp:
+        with open(os.path.join(tmp, "data.bin"), "wb") as f:
+            block = os.urandom(1000 * 1000)
+            for _ in range(args.size_mb):
+                f.write(block)
+        for transport in common.TRANSPORTS:
+            bench(transport, args.round_trips, size, tmp)
+
+
+if __name__ == "__main__":
+    main()
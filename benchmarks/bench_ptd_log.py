@@ -0,0 +1,111 @@
+#!/usr/bin/env python3
+# Copyright 2018 The MLPerf Authors. All Rights Reserved.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+# =============================================================================
+
+"""Compare the ways to parse the PTDaemon sample lines (`spl.txt`):
+* per-line: a regex match, `split(",")` and `Decimal` per field, as the server
+  did before `ptd_log`;
+* per-line with time: the same with `float` and `strptime()` for the time stamp;
+* decode: `ptd_log.decode()` into columns, including the time stamps.
+"""
+
+from decimal import Decimal
+from typing import Any, Callable, Tuple
+import argparse
+import datetime
+import os
+import sys
+import time
+
+sys.path.insert(1, os.path.join(os.path.dirname(__file__), ".."))
+
+from bench_ranging_log import MARK, log_line  # noqa
+from ptd_client_server.lib import ptd_log  # noqa
+
+
+def per_line(data: str) -> Tuple[str, str]:
+    max_volts, max_amps = Decimal(-1), Decimal(-1)
+    for line in data.splitlines():
+        if ptd_log.RE_SAMPLE.match(line) is None:
+            continue
+        words = line.split(",")
+        # The `Watts` word of the total and of each channel.
+        for i in [2, *range(13, len(words), 9)]:
+            max_volts = max(max_volts, Decimal(words[i + 3]))
+            max_amps = max(max_amps, Decimal(words[i + 5]))
+    return str(max_volts), str(max_amps)
+
+
+def per_line_time(data: str) -> Tuple[int, float]:
+    count, total = 0, 0.0
+    for line in data.splitlines():
+        if ptd_log.RE_SAMPLE.match(line) is None:
+            continue
+        words = line.split(",")
+        t = datetime.datetime.strptime(words[1], "%m-%d-%Y %H:%M:%S.%f")
+        t.replace(tzinfo=datetime.timezone.utc).timestamp()
+        for i in [2, *range(13, len(words), 9)]:
+            float(words[i + 1])
+            float(words[i + 3])
+            float(words[i + 5])
+            float(words[i + 7])
+        count += 1
+        total += float(words[3])
+    return count, total
+
+
+def decode(data: str) -> Tuple[int, float]:
+    samples = ptd_log.decode(data)
+    return samples.rows, sum(samples.channels[0].watts)
+
+
+def measure(name: str, size: int, f: Callable[[], Any]) -> Any:
+    time_start = time.monotonic()
+    result = f()
+    duration = time.monotonic() - time_start
+    print(f"{name:<20} {duration:8.2f} s  {size / duration / 1e6:8.1f} MB/s  {result}")
+    return result
+
+
+def main() -> None:
+    parser = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+    # fmt: off
+    parser.add_argument(
+        "--size-mb", metavar="N", type=int, default=100,
+        help="size of the synthetic log, defaults to 100")
+    parser.add_argument(
+        "--channels", metavar="N", type=int, default=3,
+        help="number of analyzer channels, defaults to 3")
+    # fmt: on
+    args = parser.parse_args()
+
+    block = "".join(log_line(n, MARK, args.channels) for n in range(10000))
+    data = block * max(1, args.size_mb * 1000 * 1000 // len(block))
+    print(f"Parsing {len(data) / 1e6:.0f} MB log with {args.channels} channels...")
+
+    measure("per-line", len(data), lambda: per_line(data))
+    results = [
+        measure("per-line with time", len(data), lambda: per_line_time(data)),
+        measure("decode", len(data), lambda: decode(data)),
+    ]
+    assert results[0][0] == results[1][0], "Results differ"
+
+    samples = ptd_log.decode(data, keep_text=True)
+    samples.check_channels(1, args.channels)
+    assert samples.max_volts_amps(1, args.channels) == per_line(data)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,118 @@
+#!/usr/bin/env python3
+# Copyright 2018 The MLPerf Authors. All Rights Reserved.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+# =============================================================================
+
+"""Compare the ways the server extracts the ranging results from the PTDaemon
+log file:
+* two-pass: `read_log()` followed by `max_volts_amps()`, both reading the whole
+  file from the start;
+* single-pass: `extract_ranging_log()` fed by `PtdLogIndex`, either with an
+  empty index (cold) or with an index of the previous sessions (warm).
+"""
+
+from typing import Callable, Tuple
+import argparse
+import os
+import sys
+import tempfile
+import time
+
+sys.path.insert(1, os.path.join(os.path.dirname(__file__), ".."))
+
+from ptd_client_server.lib import server  # noqa
+
+MARK = "2021-01-22_15-05-02_bench_ranging"
+
+
+def log_line(n: int, mark: str, channels: int) -> str:
+    line = (
+        f"Time,01-22-2021 15:05:{n % 60:02}.313,Watts,{20 + n % 7}.970000,"
+        f"Volts,-1.000000,Amps,-1.000000,PF,-1.000000,Mark,{mark}"
+    )
+    for ch in range(1, channels + 1):
+        line += (
+            f",Ch{ch},Watts,{90 + n % 11}.060000,Volts,{120 + n % 13}.950000,"
+            f"Amps,0.{832100 + n % 1000},PF,0.938900"
+        )
+    return line + "\n"
+
+
+def write_log(f: "os.PathLike[str]", size: int, mark: str, channels: int) -> None:
+    with open(f, "a") as out:
+        block = "".join(log_line(n, mark, channels) for n in range(10000))
+        for _ in range(max(1, size // len(block))):
+            out.write(block)
+
+
+def measure(name: str, f: Callable[[], Tuple[str, str]]) -> Tuple[str, str]:
+    time_start = time.monotonic()
+    result = f()
+    print(f"{name:<24} {time.monotonic() - time_start:8.2f} s  {result}")
+    return result
+
+
+def main() -> None:
+    parser = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+    # fmt: off
+    parser.add_argument(
+        "--size-mb", metavar="N", type=int, default=1024,
+        help="size of the synthetic log file, defaults to 1024")
+    parser.add_argument(
+        "--ranging-share", metavar="X", type=float, default=0.1,
+        help="share of the log taken by the session being stopped, defaults to 0.1")
+    parser.add_argument(
+        "--channels", metavar="N", type=int, default=3,
+        help="number of analyzer channels, defaults to 3")
+    parser.add_argument(
+        "--dir", metavar="DIR", type=str, default=None,
+        help="directory for temporary files")
+    # fmt: on
+    args = parser.parse_args()
+
+    size = args.size_mb * 1000 * 1000
+    ranging_size = int(size * args.ranging_share)
+
+    with tempfile.TemporaryDirectory(dir=args.dir) as tmp:
+        log = os.path.join(tmp, "ptd_log.txt")
+        spl = os.path.join(tmp, "spl.txt")
+
+        print(f"Generating {args.size_mb} MB log with {args.channels} channels...")
+        write_log(log, size - ranging_size, "previous_session", args.channels)
+        warm_index = server.PtdLogIndex(log)
+        warm_index.update()
+        write_log(log, ranging_size, MARK, args.channels)
+
+        def two_pass() -> Tuple[str, str]:
+            with open(spl, "w") as f:
+                f.write(server.read_log(log, MARK))
+            return server.max_volts_amps(log, MARK, 1, args.channels)
+
+        def single_pass(index: server.PtdLogIndex) -> Tuple[str, str]:
+            with open(spl, "w") as f:
+                return server.extract_ranging_log(
+                    index.iter_lines(MARK), f, MARK, 1, args.channels
+                )
+
+        cold_index = server.PtdLogIndex(log)
+        results = [
+            measure("two-pass", two_pass),
+            measure("single-pass, cold index", lambda: single_pass(cold_index)),
+            measure("single-pass, warm index", lambda: single_pass(warm_index)),
+        ]
+        assert all(r == results[0] for r in results), "Results differ"
+
+
+if __name__ == "__main__":
+    main()
@@ -15,16 +15,27 @@
 # =============================================================================
 
 from collections import OrderedDict
+from concurrent.futures import ProcessPoolExecutor
 from datetime import datetime, timezone
-from typing import Dict, List, Tuple, Any, Optional, Callable
+from functools import lru_cache
+from typing import Dict, List, Tuple, Any, Optional, Callable, Iterator
 import argparse
-import hashlib
+import csv
+import dataclasses
 import json
+import mmap
 import os
 import re
+import sys
+import time
 import traceback
 import uuid
 
+sys.path.insert(1, os.path.join(os.path.dirname(__file__), ".."))
+
+from ptd_client_server.lib import loadgen_log  # type: ignore # noqa
+from ptd_client_server.lib import source_hashes  # type: ignore # noqa
+
 
 class LineWithoutTimeStamp(Exception):
     pass
@@ -84,6 +95,78 @@ def _sort_dict(x: Dict[str, Any]) -> "OrderedDict[str, Any]":
     return OrderedDict(sorted(x.items()))
 
 
+# Files modified this recently are hashed but not cached: they could still be
+# changed without changing the mtime, if the clock resolution is coarse.
+HASH_CACHE_MIN_AGE_NS = 2 * 10 ** 9
+
+
+class HashCache:
+    """SHA-1 of files kept between runs of the checker, so the files of the
+    sessions that were already checked are not hashed again. An entry is used
+    only if the path, size, mtime and inode of the file are still the same.
+    """
+
+    VERSION = 1
+
+    def __init__(self, fname: str, verify: bool = False) -> None:
+        self.fname = fname
+        self.verify = verify
+        # Absolute path -> [size, mtime_ns, inode, sha1]
+        self.entries: Dict[str, List[Any]] = {}
+        # The entries added since the last pop_updates()
+        self.updates: Dict[str, List[Any]] = {}
+        # Files whose content does not match the entry, found when verifying
+        self.stale: List[str] = []
+        try:
+            with open(fname, "r") as f:
+                data = json.load(f)
+            if data.get("version") == self.VERSION:
+                self.entries = data["files"]
+        except FileNotFoundError:
+            pass
+        except (ValueError, KeyError, AttributeError) as e:
+            print(f"Ignoring invalid hash cache {fname!r}: {e}", file=sys.stderr)
+
+    def hash_file(self, path: str) -> str:
+        path = os.path.abspath(path)
+        st = os.stat(path)
+        key = [st.st_size, st.st_mtime_ns, st.st_ino]
+        entry = self.entries.get(path)
+        if entry is not None and entry[:3] == key and not self.verify:
+            return str(entry[3])
+
+        sha1: str = source_hashes.hash_file(path)
+        if entry is not None and entry[:3] == key and entry[3] != sha1:
+            self.stale.append(path)
+        if time.time_ns() - st.st_mtime_ns >= HASH_CACHE_MIN_AGE_NS:
+            self.entries[path] = self.updates[path] = key + [sha1]
+        return sha1
+
+    def pop_updates(self) -> Tuple[Dict[str, List[Any]], List[str]]:
+        updates, stale = self.updates, self.stale
+        self.updates, self.stale = {}, []
+        return updates, stale
+
+    def merge(self, updates: Dict[str, List[Any]], stale: List[str]) -> None:
+        self.entries.update(updates)
+        self.stale.extend(stale)
+
+    def save(self) -> None:
+        tmp_fname = f"{self.fname}.tmp{os.getpid()}"
+        with open(tmp_fname, "w") as f:
+            json.dump({"version": self.VERSION, "files": self.entries}, f)
+        os.replace(tmp_fname, self.fname)
+
+
+# Set by --hash-cache.
+hash_cache: Optional[HashCache] = None
+
+
+def set_hash_cache(cache: Optional[HashCache]) -> None:
+    global hash_cache
+    hash_cache = cache
+
+
 def hash_dir(dirname: str) -> Dict[str, str]:
     result: Dict[str, str] = {}
 
@@ -93,22 +176,15 @@ def hash_dir(dirname: str) -> Dict[str, str]:
             relpath = ""
         for file in files:
             fname = os.path.join(relpath, file)
-            with open(os.path.join(path, file), "rb") as f:
-                result[_normalize(fname)] = hashlib.sha1(f.read()).hexdigest()
+            full_fname = os.path.join(path, file)
+            if hash_cache is not None:
+                result[_normalize(fname)] = hash_cache.hash_file(full_fname)
+            else:
+                result[_normalize(fname)] = source_hashes.hash_file(full_fname)
 
     return _sort_dict(result)
 
 
-def get_time_from_line(
-    line: str, data_regexp: str, file: str, timezone_offset: int
-) -> float:
-    log_time_str = re.search(data_regexp, line)
-    if log_time_str and log_time_str.group(0):
-        log_datetime = datetime.strptime(log_time_str.group(0), "%m-%d-%Y %H:%M:%S.%f")
-        return log_datetime.replace(tzinfo=timezone.utc).timestamp() + timezone_offset
-    raise LineWithoutTimeStamp(f"{line.strip()!r} in {file}.")
-
-
 class SessionDescriptor:
     def __init__(self, path: str):
         self.path = path
@@ -155,14 +231,18 @@ def compare_dicts(s1: Dict[str, str], s2: Dict[str, str], comment: str) -> None:
     compare_dicts_values(s1, s2, comment)
 
 
+@lru_cache(maxsize=None)
+def _load_sources_checksums() -> List[Any]:
+    with open(os.path.join(os.path.dirname(__file__), "sources_checksums.json")) as f:
+        return json.load(f)  # type: ignore
+
+
 def sources_check(sd: SessionDescriptor) -> None:
     """Compare the current checksum of the code from client.json or server.json
     against the standard checksum of the source code from sources_checksums.json.
     """
     s = sd.json_object["sources"]
-
-    with open(os.path.join(os.path.dirname(__file__), "sources_checksums.json")) as f:
-        sources_samples = json.load(f)
+    sources_samples = _load_sources_checksums()
 
     assert s in sources_samples, f"{s} do not exist in 'sources_checksums.json'"
 
@@ -267,31 +347,15 @@ def uuid_check(client_sd: SessionDescriptor, server_sd: SessionDescriptor) -> No
 def _get_begin_end_time_from_mlperf_log_detail(
     path: str, client_sd: SessionDescriptor
 ) -> Tuple[float, float]:
-    system_begin = None
-    system_end = None
-
     timezone_offset = int(client_sd.json_object["timezone"])
-
     file = os.path.join(path, "mlperf_log_detail.txt")
+    return _read_begin_end_time(file, timezone_offset)
 
-    with open(file) as f:
-        for line in f:
-            if re.search("power_begin", line.lower()):
-                system_begin = get_time_from_line(
-                    line,
-                    r"(\d*-\d*-\d* \d*:\d*:\d*\.\d*)",
-                    file,
-                    timezone_offset,
-                )
-            elif re.search("power_end", line.lower()):
-                system_end = get_time_from_line(
-                    line,
-                    r"(\d*-\d*-\d* \d*:\d*:\d*\.\d*)",
-                    file,
-                    timezone_offset,
-                )
-            if system_begin and system_end:
-                break
+
+# Both phases_check() and check_ptd_logs() need the times of the testing mode.
+@lru_cache(maxsize=None)
+def _read_begin_end_time(file: str, timezone_offset: int) -> Tuple[float, float]:
+    system_begin, system_end = loadgen_log.power_times(file, timezone_offset)
 
     assert system_begin is not None, f"Can not get power_begin time from {file!r}"
     assert system_end is not None, f"Can not get power_end time from {file!r}"
@@ -487,6 +551,58 @@ def results_check(
     result_files_compare(results, result_paths_copy, result_path)
 
 
+# Lines of ptd_logs.txt that check_ptd_logs() looks at. Everything else, i.e.
+# the sample lines, is skipped without being decoded.
+PTD_LOG_CANDIDATE = re.compile(
+    rb"WARNING:|ERROR:|Uncertainty checking for Yokogawa"
+    rb"|: Go with mark|: Completed test"
+)
+PTD_LOG_TIME = re.compile(r"(\d\d-\d\d-\d\d\d\d \d\d:\d\d):(\d\d)\.(\d\d\d)")
+
+
+@lru_cache(maxsize=None)
+def _minute_timestamp(minute: str) -> int:
+    log_datetime = datetime.strptime(minute, "%m-%d-%Y %H:%M")
+    return int(log_datetime.replace(tzinfo=timezone.utc).timestamp())
+
+
+def get_time_from_ptd_log_line(line: str, file: str, timezone_offset: int) -> float:
+    """Return the time stamp at the beginning of a PTD log line as a UNIX
+    timestamp. strptime() is called once per minute rather than once per line."""
+    m = PTD_LOG_TIME.match(line)
+    if m is None:
+        raise LineWithoutTimeStamp(f"{line.strip()!r} in {file}.")
+    seconds = int(m.group(2))
+    if seconds > 59:
+        raise ValueError("second must be in 0..59")
+    seconds += _minute_timestamp(m.group(1))
+    microseconds = seconds * 10 ** 6 + int(m.group(3)) * 1000
+    # Divide like timedelta.total_seconds() to get the same float.
+    return microseconds / 10 ** 6 + timezone_offset
+
+
+def scan_lines(path: str, pattern: "re.Pattern[bytes]") -> Iterator[str]:
+    """Yield the lines of the file that contain a match of the pattern.
+    The file is memory-mapped and searched in a single pass, so only the
+    matching lines are copied and decoded.
+    """
+    with open(path, "rb") as f:
+        if os.fstat(f.fileno()).st_size == 0:
+            return  # mmap can't map an empty file
+        with mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ) as data:
+            pos = 0
+            while True:
+                match = pattern.search(data, pos)
+                if match is None:
+                    return
+                start = data.rfind(b"\n", 0, match.start()) + 1
+                end = data.find(b"\n", match.end())
+                if end == -1:
+                    end = len(data)
+                yield data[start:end].rstrip(b"\r").decode(errors="replace")
+                pos = end + 1
+
+
 def check_ptd_logs(
     server_sd: SessionDescriptor, client_sd: SessionDescriptor, path: str
 ) -> None:
@@ -502,17 +618,16 @@ def check_ptd_logs(
     )
 
     file_path = os.path.join(path, "power", "ptd_logs.txt")
-    date_regexp = r"(^\d\d-\d\d-\d\d\d\d \d\d:\d\d:\d\d.\d\d\d)"
     timezone_offset = int(server_sd.json_object["timezone"])
 
-    with open(file_path, "r") as f:
-        ptd_log_lines = f.readlines()
+    def get_log_time(line: str) -> float:
+        return get_time_from_ptd_log_line(line, file_path, timezone_offset)
 
     def find_error_or_warning(reg_exp: str, line: str, error: bool) -> None:
         problem_line = re.search(reg_exp, line)
 
         if problem_line and problem_line.group(0):
-            log_time = get_time_from_line(line, date_regexp, file_path, timezone_offset)
+            log_time = get_log_time(line)
             if start_ranging_time is None or stop_ranging_time is None:
                 assert False, "Can not find ranging time in ptd_logs.txt."
             if error:
@@ -531,59 +646,45 @@ def check_ptd_logs(
 
     start_ranging_line = f": Go with mark {ranging_mark!r}"
 
-    def get_msg_without_time(line: str) -> Optional[str]:
-        try:
-            get_time_from_line(line, date_regexp, file_path, timezone_offset)
-        except LineWithoutTimeStamp:
-            return line
-        msg_o = re.search(f"(?<={date_regexp}).+", line)
-        if msg_o is None:
-            return None
-        return msg_o.group(0).strip()
-
-    for line in ptd_log_lines:
-        msg = get_msg_without_time(line)
-        if msg is None:
-            continue
-        if (not start_ranging_time) and (start_ranging_line == msg):
-            start_ranging_time = get_time_from_line(
-                line, date_regexp, file_path, timezone_offset
-            )
-        if (not stop_ranging_time) and bool(start_ranging_time):
-            if ": Completed test" == msg:
-                stop_ranging_time = get_time_from_line(
-                    line, date_regexp, file_path, timezone_offset
-                )
-                break
+    uncertainty_line = None
+    problem_lines: List[str] = []
+
+    # Collect the lines for all the checks in one pass, then check them in
+    # order: ranging, uncertainty, warnings and errors.
+    for line in scan_lines(file_path, PTD_LOG_CANDIDATE):
+        if stop_ranging_time is None:
+            time_match = PTD_LOG_TIME.match(line)
+            msg = line[time_match.end() :].strip() if time_match else None
+            if start_ranging_time is None:
+                if start_ranging_line == msg:
+                    start_ranging_time = get_log_time(line)
+            elif ": Completed test" == msg:
+                stop_ranging_time = get_log_time(line)
+        if uncertainty_line is None and re.search(
+            r"Uncertainty checking for Yokogawa\S+ is activated", line
+        ):
+            uncertainty_line = line
+        if "WARNING:" in line or "ERROR:" in line:
+            problem_lines.append(line)
 
     if start_ranging_time is None or stop_ranging_time is None:
         assert False, "Can not find ranging time in ptd_logs.txt."
 
-    is_uncertainty_check_activated = False
-
-    for line in ptd_log_lines:
-        msg_o = re.search(r"Uncertainty checking for Yokogawa\S+ is activated", line)
-        if msg_o is not None:
-            try:
-                log_time = None
-                log_time = get_time_from_line(
-                    line, date_regexp, file_path, timezone_offset
-                )
-            except LineWithoutTimeStamp:
-                assert (
-                    log_time is not None
-                ), "ptd_logs.txt: Can not get timestamp for 'Uncertainty checking for Yokogawa... is activated' message."
-            assert (
-                start_ranging_time is not None and log_time < start_ranging_time
-            ), "ptd_logs.txt: Uncertainty checking Yokogawa... was activated after ranging mode was started."
-            is_uncertainty_check_activated = True
-            break
-
     assert (
-        is_uncertainty_check_activated
+        uncertainty_line is not None
     ), "ptd_logs.txt: Line 'Uncertainty checking for Yokogawa... is activated' is not found."
+    try:
+        log_time = None
+        log_time = get_log_time(uncertainty_line)
+    except LineWithoutTimeStamp:
+        assert (
+            log_time is not None
+        ), "ptd_logs.txt: Can not get timestamp for 'Uncertainty checking for Yokogawa... is activated' message."
+    assert (
+        start_ranging_time is not None and log_time < start_ranging_time
+    ), "ptd_logs.txt: Uncertainty checking Yokogawa... was activated after ranging mode was started."
 
-    for line in ptd_log_lines:
+    for line in problem_lines:
         find_error_or_warning("(?<=WARNING:).+", line, error=False)
         find_error_or_warning("(?<=ERROR:).+", line, error=True)
 
@@ -629,31 +730,70 @@ def version_check() -> None:
     assert False, "using of not-yet released version of checker"
 
 
-def check_with_logging(check_name: str, check: Callable[[], None]) -> Tuple[bool, bool]:
+PASSED = "passed"
+WARNING = "warning"
+FAILED = "failed"
+
+
+@dataclasses.dataclass
+class CheckResult:
+    name: str
+    status: str  # PASSED, WARNING or FAILED
+    message: str = ""
+    traceback: Optional[str] = None  # set for unhandled exceptions
+
+
+@dataclasses.dataclass
+class SessionResult:
+    path: str
+    checks: List[CheckResult]
+
+    @property
+    def passed(self) -> bool:
+        return all(c.status != FAILED for c in self.checks)
+
+    @property
+    def warnings(self) -> bool:
+        return any(c.status == WARNING for c in self.checks)
+
+
+def run_check(check_name: str, check: Callable[[], None]) -> CheckResult:
     try:
         check()
     except AssertionError as e:
-        print(f"[ ] {check_name}")
-        print(f"\t{e}\n")
-        return False, False
+        return CheckResult(check_name, FAILED, str(e))
     except CheckerWarning as e:
-        print(f"[x] {check_name}")
-        print(f"\t{e}\n")
-        return True, True
-    except Exception:
-        print(f"[ ] {check_name}")
+        return CheckResult(check_name, WARNING, str(e))
+    except Exception as e:
+        message = "".join(traceback.format_exception_only(type(e), e)).strip()
+        return CheckResult(check_name, FAILED, message, traceback.format_exc())
+    return CheckResult(check_name, PASSED)
+
+
+def log_check_result(result: CheckResult) -> None:
+    print(f"[{' ' if result.status == FAILED else 'x'}] {result.name}")
+    if result.traceback is not None:
         print("Unhandled exeception:")
-        traceback.print_exc()
-        return False, False
-    else:
-        print(f"[x] {check_name}")
-    return True, False
+        print(result.traceback, end="", file=sys.stderr)
+    elif result.message:
+        print(f"\t{result.message}\n")
+
 
+def check_with_logging(check_name: str, check: Callable[[], None]) -> Tuple[bool, bool]:
+    result = run_check(check_name, check)
+    log_check_result(result)
+    return result.status != FAILED, result.status == WARNING
 
-def check(path: str) -> int:
+
+def load_session(path: str) -> Tuple[SessionDescriptor, SessionDescriptor]:
     client = SessionDescriptor(os.path.join(path, "power/client.json"))
     server = SessionDescriptor(os.path.join(path, "power/server.json"))
+    return client, server
+
 
+def iter_checks(
+    path: str, client: SessionDescriptor, server: SessionDescriptor
+) -> Iterator[CheckResult]:
     check_with_description = {
         "Check client sources checksum": lambda: sources_check(client),
         "Check server sources checksum": lambda: sources_check(server),
@@ -671,32 +811,177 @@ def check(path: str) -> int:
         "Check release version": lambda: version_check(),
     }
 
-    result = True
-    warnings = False
-
     for description in check_with_description.keys():
-        check_result, check_warnings = check_with_logging(
-            description, check_with_description[description]
-        )
-        result &= check_result
-        warnings |= check_warnings
+        yield run_check(description, check_with_description[description])
+
+
+def check(path: str) -> SessionResult:
+    client, server = load_session(path)
+    result = SessionResult(path, [])
+
+    for check_result in iter_checks(path, client, server):
+        log_check_result(check_result)
+        result.checks.append(check_result)
 
     print(
-        f"\n{'All' if result else 'ERROR: Not all'} checks passed"
+        f"\n{'All' if result.passed else 'ERROR: Not all'} checks passed"
+        f"{'. Warnings encountered, check for audit!' if result.warnings else ''}"
+    )
+
+    return result
+
+
+def check_session(path: str) -> SessionResult:
+    """Run the checks of a session without printing, for the batch mode.
+    A session that can't be loaded gets a single failed check instead of
+    stopping the batch.
+    """
+    session: List[Tuple[SessionDescriptor, SessionDescriptor]] = []
+    load = run_check(
+        "Load client.json and server.json",
+        lambda: session.append(load_session(path)),
+    )
+    if load.status == FAILED:
+        return SessionResult(path, [load])
+    return SessionResult(path, list(iter_checks(path, *session[0])))
+
+
+def find_sessions(root: str) -> List[str]:
+    """Find the session directories, i.e. the ones with `power/client.json` or
+    `power/server.json`, under the root directory."""
+    sessions = []
+    for path, dirs, files in os.walk(root):
+        dirs.sort()
+        if "power" in dirs and any(
+            os.path.isfile(os.path.join(path, "power", name))
+            for name in ("client.json", "server.json")
+        ):
+            sessions.append(path)
+            dirs.clear()  # a session does not contain other sessions
+    return sessions
+
+
+def _batch_job(
+    path: str,
+) -> Tuple[SessionResult, Dict[str, List[Any]], List[str]]:
+    result = check_session(path)
+    if hash_cache is None:
+        return result, {}, []
+    # Send the hashes computed by this worker back to the main process.
+    updates, stale = hash_cache.pop_updates()
+    return result, updates, stale
+
+
+def check_batch(root: str, jobs: int) -> List[SessionResult]:
+    sessions = find_sessions(root)
+    print(f"Checking {len(sessions)} sessions in {root!r}...\n")
+
+    results = []
+    with ProcessPoolExecutor(
+        max_workers=jobs, initializer=set_hash_cache, initargs=(hash_cache,)
+    ) as executor:
+        for result, updates, stale in executor.map(_batch_job, sessions):
+            if hash_cache is not None:
+                hash_cache.merge(updates, stale)
+            print(f"[{'x' if result.passed else ' '}] {result.path}")
+            for c in result.checks:
+                if c.status != PASSED:
+                    print(f"\t[{'x' if c.status == WARNING else ' '}] {c.name}")
+                    for line in c.message.splitlines():
+                        print(f"\t\t{line}")
+            results.append(result)
+
+    passed = sum(r.passed for r in results)
+    warnings = any(r.warnings for r in results)
+    print(
+        f"\n{passed} of {len(results)} sessions passed"
         f"{'. Warnings encountered, check for audit!' if warnings else ''}"
     )
+    return results
 
-    return 0 if result else 1
+
+def write_report(
+    fname: str, results: List[SessionResult], report_format: str
+) -> None:
+    with open(fname, "w", newline="") as f:
+        if report_format == "json":
+            json.dump(
+                [
+                    {
+                        "session": r.path,
+                        "passed": r.passed,
+                        "warnings": r.warnings,
+                        "checks": [dataclasses.asdict(c) for c in r.checks],
+                    }
+                    for r in results
+                ],
+                f,
+                indent=4,
+            )
+            f.write("\n")
+        else:
+            writer = csv.writer(f)
+            writer.writerow(["session", "check", "status", "message"])
+            for r in results:
+                for c in r.checks:
+                    writer.writerow([r.path, c.name, c.status, c.message])
 
 
 if __name__ == "__main__":
     parser = argparse.ArgumentParser(
         description="Check PTD client-server session results"
     )
-    parser.add_argument("session_directory", help="directory with session results data")
+    parser.add_argument(
+        "session_directory",
+        help="directory with session results data, "
+        "or with many session directories in the batch mode",
+    )
+    # fmt: off
+    parser.add_argument(
+        "-b", "--batch", action="store_true",
+        help="check all the session directories found under session_directory")
+    parser.add_argument(
+        "-j", "--jobs", metavar="N", type=int, default=os.cpu_count(),
+        help="number of sessions to check in parallel in the batch mode, "
+        "defaults to the number of CPUs")
+    parser.add_argument(
+        "-r", "--report", metavar="FILE",
+        help="write the results of the checks to FILE")
+    parser.add_argument(
+        "--report-format", choices=["json", "csv"],
+        help="format of the report, defaults to csv if FILE ends with .csv, "
+        "and to json otherwise")
+    parser.add_argument(
+        "--hash-cache", metavar="FILE",
+        help="keep the checksums of the result files in FILE between runs, "
+        "and skip hashing the files that did not change")
+    parser.add_argument(
+        "--verify-hash-cache", action="store_true",
+        help="hash all the files anyway and report the cache entries that "
+        "do not match")
+    # fmt: on
 
     args = parser.parse_args()
 
-    return_code = check(args.session_directory)
+    if args.hash_cache is not None:
+        set_hash_cache(HashCache(args.hash_cache, args.verify_hash_cache))
+    elif args.verify_hash_cache:
+        parser.error("--verify-hash-cache requires --hash-cache")
+
+    if args.batch:
+        results = check_batch(args.session_directory, max(1, args.jobs))
+    else:
+        results = [check(args.session_directory)]
+
+    if hash_cache is not None:
+        for fname in hash_cache.stale:
+            print(f"Stale hash cache entry for {fname!r}", file=sys.stderr)
+        hash_cache.save()
+
+    if args.report is not None:
+        report_format = args.report_format
+        if report_format is None:
+            report_format = "csv" if args.report.endswith(".csv") else "json"
+        write_report(args.report, results, report_format)
 
-    exit(return_code)
+    exit(0 if all(r.passed for r in results) else 1)
@@ -15,31 +15,53 @@
 # =============================================================================
 
 from typing import List
+import os
 import sys
 import argparse
-import re
 
-watts_value_reg_exp = re.compile("Watts,([-]?[0-9]+[.][0-9]+)")
+sys.path.insert(1, os.path.join(os.path.dirname(__file__), ".."))
+
+from ptd_client_server.lib import ptd_log  # type: ignore # noqa
 
 
 def get_values(path: str) -> List[float]:
-    watts_values = []
+    if path.endswith(".bin"):
+        return get_values_bin(path)
     try:
         with open(path, "r") as log:
-            lines = log.readlines()
-            if len(lines) == 0:
+            data = log.read()
+    except FileNotFoundError:
+        print(f"{path} does not exist", file=sys.stderr)
+        exit(2)
+    if len(data) == 0:
+        print(f"{path} is empty", file=sys.stderr)
+        exit(2)
+    try:
+        samples = ptd_log.decode(data)
+    except (ptd_log.LitNotFoundError, ValueError):
+        samples = ptd_log.Samples()
+    if samples.rows != len(data.splitlines()):
+        print(f"There are no watts values in {path}", file=sys.stderr)
+        exit(2)
+    watts: List[float] = samples.channels[0].watts.tolist()
+    return watts
+
+
+def get_values_bin(path: str) -> List[float]:
+    """Same as get_values(), for spl.bin written by the server next to
+    spl.txt."""
+    try:
+        with ptd_log.ColumnFile(path) as f:
+            if f.rows == 0:
                 print(f"{path} is empty", file=sys.stderr)
                 exit(2)
-            for line in lines:
-                watts = watts_value_reg_exp.findall(line)[0]
-                watts_values.append(float(watts))
+            return list(f.column("watts", 0))
     except FileNotFoundError:
         print(f"{path} does not exist", file=sys.stderr)
         exit(2)
-    except IndexError:
-        print(f"There are no watts values in {path}", file=sys.stderr)
+    except ValueError as e:
+        print(f"Could not read {path}: {e}", file=sys.stderr)
         exit(2)
-    return watts_values
 
 
 def are_charts_identical(
@@ -61,7 +83,7 @@ def are_charts_identical(
 
 
 parser = argparse.ArgumentParser(
-    description="Compare two power log files (spl.txt) with a given threshold",
+    description="Compare two power logs (spl.txt or spl.bin) with a given threshold",
     formatter_class=lambda prog: argparse.RawDescriptionHelpFormatter(
         prog, max_help_position=35
     ),
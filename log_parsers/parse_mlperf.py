@@ -13,10 +13,12 @@
 # limitations under the License.
 # =============================================================================
 
+import io
 import os
 import re
 import csv
 import sys
+import gzip
 import json
 import argparse
 
@@ -33,6 +35,11 @@ import numpy
 from dash.dependencies import Input, Output, State, ALL
 from datetime import datetime, timedelta
 from collections import defaultdict
+from concurrent.futures import ProcessPoolExecutor
+
+# The PTDaemon log parser shared with the server (ptd_client_server/lib/ptd_log.py in this repository)
+sys.path.insert( 1, os.path.join( os.path.dirname( __file__ ), ".." ) )
+from ptd_client_server.lib import ptd_log
 
 # Global Variables -- User Modifiable
 #   g_power_window*   : how much time before (BEGIN) and after (END) loadgen timestamps to show data in graph
@@ -47,8 +54,17 @@ g_power_sub_td               = timedelta(seconds=0)
 g_loadgen_data               = defaultdict(dict)
 g_graph_data                 = defaultdict(dict)
 g_figures                    = defaultdict(dict)
+g_trace_data                 = defaultdict(list)
+g_trace_summaries            = defaultdict(dict)
+g_loadgen_stats              = {}
 g_verbose                    = False
 
+# Global Variables -- Tuning
+#   g_specpower_batch_size : approximate number of characters of a PTDaemon power log parsed at a time
+g_specpower_batch_size       = 16 * 1024 * 1024
+#   g_graph_max_points     : maximum number of points of a graph trace sent to the browser (the full data is kept in the script)
+g_graph_max_points           = 2000
+
 app = dash.Dash(__name__)
 
 # Check command-line parameters and call respective functions
@@ -59,35 +75,21 @@ def main():
     if( m_args.loadgen_in != "" ):
         f_parse_Loadgen( m_args.loadgen_in, m_args.loadgen_out, m_args.workload )
 
-    if( m_args.specpower_in != "" ):
-        f_parse_SPECPowerlog( m_args.specpower_in, m_args.powerlog_out )
+    m_power_csv = m_args.powerlog_out
+    if( m_args.specpower_in ):
+        m_power_csv = f_parse_SPECPowerlogs( m_args.specpower_in, m_args.powerlog_out, m_args.jobs )
 
     if( m_args.stats is not None and m_args.loadgen_out != "" and m_args.powerlog_out != "" ):
-        f_stats( m_args.loadgen_out, m_args.powerlog_out, m_args.stats, m_args.csv )
+        f_stats( m_args.loadgen_out, m_power_csv, m_args.stats, m_args.csv )
         
     if( m_args.graph is not None and m_args.loadgen_out != "" and m_args.powerlog_out != "" ):
-        f_graph( m_args.loadgen_out, m_args.powerlog_out, m_args.graph )
+        f_graph( m_args.loadgen_out, m_power_csv, m_args.graph )
 
         
 def f_stats( p_loadgen_csv, p_power_csv, p_filter , p_stats_csv ):
     m_loadgen_data = pandas.DataFrame()
     m_power_data   = pandas.DataFrame()
    
-    if( p_stats_csv ):
-        m_stats_frame  = pandas.DataFrame( columns=['Run',
-                                                    'Workload',
-                                                    'Scenario',
-                                                    'Mode',
-                                                    'Begin Time',
-                                                    'End Time',
-                                                    'Runtime',
-                                                    'Samples',
-                                                    'Data',
-                                                    'Minimum',
-                                                    'Maximum',
-                                                    'Average',
-                                                    'Std.Dev'] )
-
     # Open loadgen data
     try:
         if( g_verbose ) : print( f"stats: opening {p_loadgen_csv} for reading" )
@@ -99,7 +101,7 @@ def f_stats( p_loadgen_csv, p_power_csv, p_filter , p_stats_csv ):
     # Open power data
     try:
         if( g_verbose ) : print( f"stats: opening {p_power_csv} for reading" )
-        m_power_data = pandas.read_csv( p_power_csv )
+        m_power_data = f_read_csv( p_power_csv )
     except:
         print( f"stats: error opening file: {p_power_csv}",  )
         exit(1)
@@ -109,38 +111,55 @@ def f_stats( p_loadgen_csv, p_power_csv, p_filter , p_stats_csv ):
     m_power_data.rename( columns = {'Date' : 'Datetime'}, inplace = True )
     m_power_data['Datetime'] = pandas.to_datetime( m_power_data['Datetime'] )
     m_power_data = m_power_data.drop( columns=['Time'] )
-    m_power_data.set_index( 'Datetime' )
+
+    # Sort the samples by time, so the samples of each run are a slice found with a binary search
+    m_power_data = m_power_data[m_power_data['Datetime'].notna()]
+    if( not m_power_data['Datetime'].is_monotonic_increasing ):
+        m_power_data = m_power_data.sort_values( 'Datetime', kind='mergesort' )
+    m_power_times = m_power_data['Datetime'].values
 
     m_dataset_count = 0
     
     if( g_verbose ) : print( "stats: loading and parsing data, please wait" )
 
-    for index, m_loadgen_entry in m_loadgen_data.iterrows():
-        m_power_ts_begin = dateutil.parser.parse( m_loadgen_entry['System Begin Date'] + " " + m_loadgen_entry['System Begin Time'] )
-        m_power_ts_end   = dateutil.parser.parse( m_loadgen_entry['System End Date']   + " " + m_loadgen_entry['System End Time']   )
-
-        m_mask_stats = (m_power_data['Datetime'] >= (m_power_ts_begin + g_power_add_td - g_power_sub_td )) & \
-                       (m_power_data['Datetime'] <= (m_power_ts_end   + g_power_add_td - g_power_sub_td ))
+    m_loadgen_entries = m_loadgen_data.to_dict( 'records' )
+    m_power_ts_begins = [ dateutil.parser.parse( m_entry['System Begin Date'] + " " + m_entry['System Begin Time'] ) for m_entry in m_loadgen_entries ]
+    m_power_ts_ends   = [ dateutil.parser.parse( m_entry['System End Date']   + " " + m_entry['System End Time']   ) for m_entry in m_loadgen_entries ]
+
+    # Interval join: samples [m_lo, m_hi) of each run are between its begin and end, inclusive
+    m_lo = numpy.searchsorted( m_power_times, pandas.to_datetime( [ m_ts + g_power_add_td - g_power_sub_td for m_ts in m_power_ts_begins ] ).values, side='left'  )
+    m_hi = numpy.searchsorted( m_power_times, pandas.to_datetime( [ m_ts + g_power_add_td - g_power_sub_td for m_ts in m_power_ts_ends   ] ).values, side='right' )
+    m_runs = [ m_index for m_index in range(len(m_loadgen_entries)) if m_lo[m_index] < m_hi[m_index] ]
+    m_lo   = m_lo[m_runs]
+    m_hi   = m_hi[m_runs]
+
+    # Statistics of every selected column for all the runs at once
+    m_headers = []
+    m_column_stats = {}
+    for m_header in ( list(m_power_data) if m_runs else [] ) :
+        if( p_filter and not re.findall(r"("+'|'.join(p_filter)+r")", m_header) ):
+            continue
 
-        m_dataframe = m_power_data.loc[m_mask_stats].copy()
-        
-        if( m_dataframe.empty ):
+        if( m_power_data[m_header].dtypes not in [numpy.int64, numpy.float64] ):
+            #if( g_verbose ) : print( f"stats: {m_header} dtype is {m_power_data[m_header].dtypes}" )
             continue
-        else:
-            m_dataset_count += 1
+
+        m_headers.append( m_header )
+        m_column_stats[m_header] = f_segment_stats( m_power_data[m_header].values, m_lo, m_hi )
+
+    m_stats_list = []
+
+    for m_run, m_index in enumerate( m_runs ):
+        m_loadgen_entry  = m_loadgen_entries[m_index]
+        m_power_ts_begin = m_power_ts_begins[m_index]
+        m_power_ts_end   = m_power_ts_ends[m_index]
+        m_samples        = m_hi[m_run] - m_lo[m_run]
+        m_dataset_count += 1
 
         if( p_stats_csv ) :
-            m_stats_list = []
-        
-            for m_header in list(m_dataframe) :
-                if( p_filter and not re.findall(r"("+'|'.join(p_filter)+r")", m_header) ):
-                    continue
-                    
-                m_data = m_dataframe[m_header]
-                
-                if( m_data.dtypes not in [numpy.int64, numpy.float64] ):
-                    continue
-                    
+            for m_header in m_headers :
+                m_min, m_max, m_mean, m_std = ( m_stat[m_run] for m_stat in m_column_stats[m_header] )
+
                 m_stats_list.append( { 'Run'        : m_dataset_count,
                                        'Workload'   : m_loadgen_entry['Workload'],
                                        'Scenario'   : m_loadgen_entry['Scenario'],
@@ -150,16 +169,14 @@ def f_stats( p_loadgen_csv, p_power_csv, p_filter , p_stats_csv ):
                                        'Runtime'    : f"{m_power_ts_end - m_power_ts_begin}",
                                        'Metric'     : m_loadgen_entry['Metric'],
                                        'Score'      : m_loadgen_entry['Score'],
-                                       'Samples'    : m_dataframe.shape[0],
+                                       'Samples'    : m_samples,
                                        'Data'       : m_header,
-                                       'Minimum'    : f"{m_data.min():.3f}",
-                                       'Maximum'    : f"{m_data.max():.3f}",
-                                       'Average'    : f"{m_data.mean():.3f}",
-                                       'Std.Dev'    : f"{m_data.std():.3f}" } )
+                                       'Minimum'    : f"{m_min:.3f}",
+                                       'Maximum'    : f"{m_max:.3f}",
+                                       'Average'    : f"{m_mean:.3f}",
+                                       'Std.Dev'    : f"{m_std:.3f}" } )
                 if( re.search( "watts?|power", m_header, re.I ) ):
-                    m_stats_list[-1].update( {'Energy' : f"{ float(m_stats_list[-1]['Average']) * (dateutil.parser.parse(m_stats_list[-1]['End Time']) - dateutil.parser.parse(m_stats_list[-1]['Begin Time'])).total_seconds():.3f}"} )
-
-            m_stats_frame = m_stats_frame.append( pandas.DataFrame( m_stats_list ) )
+                    m_stats_list[-1].update( {'Energy' : f"{ float(m_stats_list[-1]['Average']) * (m_power_ts_end - m_power_ts_begin).total_seconds():.3f}"} )
 
         else:
             print( f"Run:        {m_dataset_count}\n" +
@@ -171,26 +188,19 @@ def f_stats( p_loadgen_csv, p_power_csv, p_filter , p_stats_csv ):
                    f"Runtime:    {(m_power_ts_end - m_power_ts_begin)}\n" +
                    f"Metric:     {m_loadgen_entry['Metric']}\n" +
                    f"Score:      {m_loadgen_entry['Score']}\n" +
-                   f"Samples:    {m_dataframe.shape[0]}\n" )
+                   f"Samples:    {m_samples}\n" )
                    
-            for m_header in list(m_dataframe) :
-                if( p_filter and not re.findall(r"("+'|'.join(p_filter)+r")", m_header) ):
-                    continue
-                
-                m_data = m_dataframe[m_header]
-                
-                if( m_data.dtypes not in [numpy.int64, numpy.float64] ):
-                    #if( g_verbose ) : print( f"stats: {m_header} dtype is {m_data.dtypes}" )
-                    continue
-                
+            for m_header in m_headers :
+                m_min, m_max, m_mean, m_std = ( m_stat[m_run] for m_stat in m_column_stats[m_header] )
+
                 print( f"Data:       {m_header}\n" + 
-                       f"Minimum:    {m_data.min():.3f}\n" +
-                       f"Maximum:    {m_data.max():.3f}\n" +
-                       f"Average:    {m_data.mean():.3f}\n" +
-                       f"Std.Dev:    {m_data.std():.3f}\n" )
+                       f"Minimum:    {m_min:.3f}\n" +
+                       f"Maximum:    {m_max:.3f}\n" +
+                       f"Average:    {m_mean:.3f}\n" +
+                       f"Std.Dev:    {m_std:.3f}\n" )
                        
-                if( re.search( "\bwatts?\b|\bpower\b", m_header, re.I ) ):
-                    print( f"Energy:     {(m_data.mean() * (m_power_ts_end - m_power_ts_begin).total_seconds()):.3f}\n" )
+                if( re.search( r"\bwatts?\b|\bpower\b", m_header, re.I ) ):
+                    print( f"Energy:     {(m_mean * (m_power_ts_end - m_power_ts_begin).total_seconds()):.3f}\n" )
 
     if( g_verbose ) : print( f"stats: {m_dataset_count} entries parsed" )
 
@@ -200,6 +210,25 @@ def f_stats( p_loadgen_csv, p_power_csv, p_filter , p_stats_csv ):
         exit(1)
 
     if( p_stats_csv ):
+        m_columns = ['Run',
+                     'Workload',
+                     'Scenario',
+                     'Mode',
+                     'Begin Time',
+                     'End Time',
+                     'Runtime',
+                     'Samples',
+                     'Data',
+                     'Minimum',
+                     'Maximum',
+                     'Average',
+                     'Std.Dev',
+                     'Metric',
+                     'Score']
+        if( any( 'Energy' in m_stats for m_stats in m_stats_list ) ):
+            m_columns.append( 'Energy' )
+        m_stats_frame = pandas.DataFrame( m_stats_list, columns=m_columns )
+
         try:
             if( g_verbose ) : print( f"stats: saving stats to {p_stats_csv}\n" )
             m_stats_frame.to_csv( p_stats_csv, index=False )
@@ -209,6 +238,211 @@ def f_stats( p_loadgen_csv, p_power_csv, p_filter , p_stats_csv ):
 
     
 
+# Minimum, maximum, mean and standard deviation (ddof=1) of p_values[p_lo[i]:p_hi[i]] for each i, skipping NaN
+# like pandas does.  The slices may overlap; the statistics of an empty slice are NaN.
+def f_segment_stats( p_values, p_lo, p_hi ):
+    ( p_lo, p_hi ) = ( numpy.asarray( p_lo, dtype=numpy.intp ), numpy.asarray( p_hi, dtype=numpy.intp ) )
+    if( not len(p_lo) ):
+        return tuple( numpy.empty( 0 ) for m_stat in range(4) )
+
+    m_values = p_values.astype( numpy.float64 )
+    m_valid  = ~numpy.isnan( m_values )
+
+    # Shift the values by their mean, so the sums of squares do not lose precision
+    m_shift   = m_values[m_valid].mean() if m_valid.any() else 0.0
+    m_shifted = numpy.where( m_valid, m_values - m_shift, 0.0 )
+
+    # reduceat() over the index pairs (lo, hi) reduces each slice; the results for (hi, next lo) are dropped.
+    # An extra element at the end allows hi == len(p_values).
+    m_index = numpy.empty( 2 * len(p_lo), dtype=numpy.intp )
+    m_index[0::2] = p_lo
+    m_index[1::2] = p_hi
+
+    def f_reduce( p_ufunc, p_array, p_pad ):
+        return p_ufunc.reduceat( numpy.append( p_array, p_pad ), m_index )[0::2]
+
+    m_count = f_reduce( numpy.add,  m_valid.astype( numpy.float64 ), 0.0 )
+    m_sum   = f_reduce( numpy.add,  m_shifted, 0.0 )
+    m_sumsq = f_reduce( numpy.add,  m_shifted * m_shifted, 0.0 )
+    m_min   = f_reduce( numpy.fmin, m_values, numpy.nan )
+    m_max   = f_reduce( numpy.fmax, m_values, numpy.nan )
+
+    # reduceat() gives the element at lo for an empty slice
+    m_empty = p_hi <= p_lo
+    m_count[m_empty] = 0.0
+    m_sum[m_empty]   = 0.0
+    m_sumsq[m_empty] = 0.0
+    m_min[m_empty]   = numpy.nan
+    m_max[m_empty]   = numpy.nan
+
+    with numpy.errstate( divide='ignore', invalid='ignore' ):
+        m_mean = m_sum / m_count
+        m_var  = numpy.maximum( m_sumsq - m_sum * m_mean, 0.0 ) / ( m_count - 1 )
+    m_std = numpy.where( m_count > 1, numpy.sqrt( m_var ), numpy.nan )
+
+    return m_min, m_max, m_mean + m_shift, m_std
+
+
+# Reduce a trace to at most p_max_points points for the browser.  The samples are split into buckets and the
+# minimum and maximum of each bucket are kept (in time order, along with the first and last sample), so peaks
+# and dips survive the downsampling.  Non-numeric data is just strided.
+def f_downsample( p_x, p_y, p_max_points ):
+    m_count   = len( p_x )
+    m_buckets = ( p_max_points - 2 ) // 2
+    if( m_count <= p_max_points or m_buckets < 1 ):
+        return ( p_x, p_y )
+
+    # Recount the buckets, so the padding is shorter than one bucket and every bucket has samples
+    m_size    = -( -m_count // m_buckets )
+    m_buckets = -( -m_count // m_size )
+    if( numpy.issubdtype( p_y.dtype, numpy.number ) ):
+        # Pad to whole buckets; NaN and the padding never win the minimum or maximum of a bucket
+        m_values  = p_y.astype( numpy.float64 )
+        m_pad     = m_size * m_buckets - m_count
+        m_lows    = numpy.append( numpy.where( numpy.isnan( m_values ), numpy.inf,  m_values ), numpy.full( m_pad, numpy.inf  ) )
+        m_highs   = numpy.append( numpy.where( numpy.isnan( m_values ), -numpy.inf, m_values ), numpy.full( m_pad, -numpy.inf ) )
+        m_offsets = numpy.arange( m_buckets ) * m_size
+        m_index   = numpy.concatenate( ( [0, m_count - 1],
+                                         m_offsets + m_lows.reshape( m_buckets, m_size ).argmin( axis=1 ),
+                                         m_offsets + m_highs.reshape( m_buckets, m_size ).argmax( axis=1 ) ) )
+    else:
+        m_index = numpy.append( numpy.arange( 0, m_count, m_size ), m_count - 1 )
+
+    m_index = numpy.unique( m_index )
+    return ( p_x[m_index], p_y[m_index] )
+
+
+# Downsample the part of a trace between the times p_range = [begin, end], or the whole trace if p_range is None.
+# One sample on each side of the range is included, so the lines reach the edges of the graph.
+def f_zoom_trace( p_x, p_y, p_range, p_max_points ):
+    if( p_range is not None ):
+        ( m_begin, m_end ) = ( pandas.Timestamp( m_time ).to_datetime64() for m_time in p_range )
+        m_lo = max( numpy.searchsorted( p_x, m_begin, side='left'  ) - 1, 0 )
+        m_hi = min( numpy.searchsorted( p_x, m_end,   side='right' ) + 1, len( p_x ) )
+        ( p_x, p_y ) = ( p_x[m_lo:m_hi], p_y[m_lo:m_hi] )
+    return f_downsample( p_x, p_y, p_max_points )
+
+
+# Get the new time range of a graph from its relayoutData: ( True, [begin, end] ) after zooming or panning,
+# ( True, None ) after an autorange (i.e. double click), and ( False, None ) if the time axis did not change.
+def f_relayout_range( p_relayout ):
+    if( not p_relayout ):
+        return ( False, None )
+    if( 'xaxis.range[0]' in p_relayout and 'xaxis.range[1]' in p_relayout ):
+        m_range = [ p_relayout['xaxis.range[0]'], p_relayout['xaxis.range[1]'] ]
+    elif( 'xaxis.range' in p_relayout ):
+        m_range = p_relayout['xaxis.range']
+    elif( p_relayout.get( 'xaxis.autorange' ) ):
+        return ( True, None )
+    else:
+        return ( False, None )
+    return ( True, list( m_range ) )
+
+
+# Segment tree of p_ufunc (numpy.fmin or numpy.fmax) over p_values: leaf i is at m_tree[m_size + i], and every
+# node holds the reduction of its two children.  Built one level at a time, NaN is skipped like pandas does.
+def f_segment_tree( p_values, p_ufunc ):
+    m_size = 1 << max( len(p_values) - 1, 0 ).bit_length()
+    m_tree = numpy.full( 2 * m_size, numpy.nan )
+    m_tree[m_size:m_size + len(p_values)] = p_values
+    m_level = m_size // 2
+    while( m_level ):
+        m_nodes = numpy.arange( m_level, 2 * m_level )
+        m_tree[m_nodes] = p_ufunc( m_tree[2 * m_nodes], m_tree[2 * m_nodes + 1] )
+        m_level //= 2
+    return m_tree
+
+
+# Reduce the leaves [p_lo, p_hi) of a segment tree in O(log n)
+def f_segment_query( p_tree, p_ufunc, p_lo, p_hi ):
+    m_result = numpy.nan
+    ( m_lo, m_hi ) = ( p_lo + len(p_tree) // 2, p_hi + len(p_tree) // 2 )
+    while( m_lo < m_hi ):
+        if( m_lo & 1 ):
+            m_result = p_ufunc( m_result, p_tree[m_lo] )
+            m_lo += 1
+        if( m_hi & 1 ):
+            m_hi -= 1
+            m_result = p_ufunc( m_result, p_tree[m_hi] )
+        m_lo //= 2
+        m_hi //= 2
+    return m_result
+
+
+# Summary of the full data of a graph trace answering the statistics of any time range in O(log n):
+# prefix counts and sums (of the values shifted by their mean, for precision) for the mean and standard
+# deviation, and segment trees for the minimum and maximum.  Non-numeric data only gets the times.
+def f_build_summary( p_x, p_y ):
+    m_summary = { 'x' : p_x, 'numeric' : numpy.issubdtype( p_y.dtype, numpy.number ) }
+    if( m_summary['numeric'] ):
+        m_values  = p_y.astype( numpy.float64 )
+        m_valid   = ~numpy.isnan( m_values )
+        m_shift   = m_values[m_valid].mean() if m_valid.any() else 0.0
+        m_shifted = numpy.where( m_valid, m_values - m_shift, 0.0 )
+        m_summary.update( { 'shift' : m_shift,
+                            'count' : numpy.concatenate( ( [0], numpy.cumsum( m_valid ) ) ),
+                            'sum'   : numpy.concatenate( ( [0.0], numpy.cumsum( m_shifted ) ) ),
+                            'sumsq' : numpy.concatenate( ( [0.0], numpy.cumsum( m_shifted * m_shifted ) ) ),
+                            'min'   : f_segment_tree( m_values, numpy.fmin ),
+                            'max'   : f_segment_tree( m_values, numpy.fmax ) } )
+    return m_summary
+
+
+# Summary of trace p_curve of the graph of p_header, built the first time it is needed
+def f_trace_summary( p_header, p_curve ):
+    if( p_curve not in g_trace_summaries[p_header] ):
+        g_trace_summaries[p_header][p_curve] = f_build_summary( *g_trace_data[p_header][p_curve] )
+    return g_trace_summaries[p_header][p_curve]
+
+
+# Statistics of the samples of a trace summary between the times p_begin and p_end (inclusive):
+# ( samples, duration, minimum, maximum, mean, std.dev ), the last four are None for non-numeric data.
+# Returns None if there are no samples in the range.
+def f_summary_stats( p_summary, p_begin, p_end ):
+    m_lo = numpy.searchsorted( p_summary['x'], p_begin, side='left'  )
+    m_hi = numpy.searchsorted( p_summary['x'], p_end,   side='right' )
+    if( m_lo >= m_hi ):
+        return None
+
+    m_duration = pandas.Timedelta( p_summary['x'][m_hi - 1] - p_summary['x'][m_lo] ).to_pytimedelta()
+    if( not p_summary['numeric'] ):
+        return ( m_hi - m_lo, m_duration, None, None, None, None )
+
+    m_count = p_summary['count'][m_hi] - p_summary['count'][m_lo]
+    m_sum   = p_summary['sum'][m_hi]   - p_summary['sum'][m_lo]
+    m_sumsq = p_summary['sumsq'][m_hi] - p_summary['sumsq'][m_lo]
+    m_mean  = m_sum / m_count + p_summary['shift'] if m_count else numpy.nan
+    m_std   = numpy.sqrt( max( m_sumsq - m_sum * m_sum / m_count, 0.0 ) / ( m_count - 1 ) ) if m_count > 1 else numpy.nan
+
+    return ( m_hi - m_lo, m_duration,
+             f_segment_query( p_summary['min'], numpy.fmin, m_lo, m_hi ),
+             f_segment_query( p_summary['max'], numpy.fmax, m_lo, m_hi ),
+             m_mean, m_std )
+
+
+# Same statistics for the loadgen run window of run p_run in the graph of p_header, computed once
+def f_loadgen_stats( p_header, p_run ):
+    if( ( p_header, p_run ) not in g_loadgen_stats ):
+        m_frame    = g_graph_data[p_run]
+        m_duration = m_frame['Datetime'].max() - m_frame['Datetime'].min()
+        if( numpy.issubdtype( m_frame[p_header].dtype, numpy.number ) ):
+            m_stats = ( m_frame[p_header].min(), m_frame[p_header].max(), m_frame[p_header].mean(), m_frame[p_header].std() )
+        else:
+            m_stats = ( None, None, None, None )
+        g_loadgen_stats[( p_header, p_run )] = ( m_frame.shape[0], m_duration ) + m_stats
+    return g_loadgen_stats[( p_header, p_run )]
+
+
+# Same statistics for a frame of selected points ('x' and 'y' columns)
+def f_frame_stats( p_frame ):
+    m_x        = pandas.to_datetime( p_frame['x'] )
+    m_duration = ( m_x.max() - m_x.min() ).to_pytimedelta()
+    if( not numpy.issubdtype( p_frame['y'].dtype, numpy.number ) ):
+        return ( p_frame.shape[0], m_duration, None, None, None, None )
+    return ( p_frame.shape[0], m_duration, p_frame['y'].min(), p_frame['y'].max(), p_frame['y'].mean(), p_frame['y'].std() )
+
+
+
 #### Graph data over time
 ####  Parses the loadgen data for BEGIN and END times
 ####  Parses the power data (or any CSV data with a header) and tries to plot over time
@@ -227,7 +461,7 @@ def f_graph( p_loadgen_csv, p_power_csv, p_filter ):
     # Open power/raw data
     try:
         if( g_verbose ) : print( f"graph: opening {p_power_csv} for reading" )
-        m_graph_data = pandas.read_csv( p_power_csv )
+        m_graph_data = f_read_csv( p_power_csv )
     except:
         print( f"graph: error opening file: {p_power_csv}",  )
         exit(1)
@@ -238,6 +472,8 @@ def f_graph( p_loadgen_csv, p_power_csv, p_filter ):
     m_graph_data['Datetime'] = pandas.to_datetime( m_graph_data['Datetime'] )
     m_graph_data = m_graph_data.drop( columns=['Time'] )
     m_graph_data.set_index( 'Datetime' )
+    # Keep the samples in time order, zooming looks up the visible range of each trace by time
+    m_graph_data = m_graph_data.sort_values( 'Datetime', kind='mergesort' ).reset_index( drop=True )
 
     m_dataset_count = 0
     
@@ -270,15 +506,20 @@ def f_graph( p_loadgen_csv, p_power_csv, p_filter ):
                                                           'yanchor': 'top' },
                                                     xaxis_title="Time (offset between powerlog & loadgen timestamps)",
                                                     xaxis_tickformat='%H:%M:%S.%L',
-                                                    yaxis_title=f"{m_header}" )
+                                                    yaxis_title=f"{m_header}",
+                                                    uirevision=f"{m_header}" )
 
             # Zero the timescale to difference between loadgen and data timestamps
             # Zero'ing causes datetime to be a timedelta, add an "arbitrary" date to convert back into datetime
             m_dataframe.loc[:,'Datetime'] -= m_dataframe['Datetime'].iloc[0]
             m_dataframe.loc[:,'Datetime'] += datetime( 2011, 1, 13 )
 
-            g_figures[m_header].add_trace( pgo.Scatter( x=m_dataframe['Datetime'],
-                                                        y=m_dataframe[m_header],
+            # Keep the full data for zooming, the browser only gets a downsampled overview
+            g_trace_data[m_header].append( ( m_dataframe['Datetime'].to_numpy(), m_dataframe[m_header].to_numpy() ) )
+            ( m_trace_x, m_trace_y ) = f_downsample( *g_trace_data[m_header][-1], g_graph_max_points )
+
+            g_figures[m_header].add_trace( pgo.Scatter( x=m_trace_x,
+                                                        y=m_trace_y,
                                                         mode="lines+markers",
                                                         line=dict(color=pex.colors.qualitative.Plotly[m_dataset_count%len(pex.colors.qualitative.Plotly)]),
                                                         marker=dict(color=pex.colors.qualitative.Plotly[m_dataset_count%len(pex.colors.qualitative.Plotly)]),
@@ -372,16 +613,41 @@ def f_graph( p_loadgen_csv, p_power_csv, p_filter ):
                    Output( 'div-selected-stats-trigger', 'children' )],
                   [Input(  'input-box-filter-by-keywords', 'value'),
                    Input(  'input-box-filter-by-run-id',   'value'),
-                   Input( { 'type':'graph-obj', 'data': ALL, 'index': ALL }, 'restyleData' )],
+                   Input( { 'type':'graph-obj', 'data': ALL, 'index': ALL }, 'restyleData' ),
+                   Input( { 'type':'graph-obj', 'data': ALL, 'index': ALL }, 'relayoutData' )],
                   [State( {'type': 'graph-obj', 'data': ALL, 'index': ALL }, 'figure'),
                    State( 'div-loadgen-stats-trigger', 'children' ),
                    State( 'div-selected-stats-trigger', 'children' ),
                    State( 'dropdown-graph-select', 'value' )] )
-    def f_dash_filterDatasets( p_filter_keywords, p_filter_run_id, p_restyleData, s_graph_obj_figures, s_loadgen_trigger, s_selected_trigger, s_graph_select ):
+    def f_dash_filterDatasets( p_filter_keywords, p_filter_run_id, p_restyleData, p_relayoutData, s_graph_obj_figures, s_loadgen_trigger, s_selected_trigger, s_graph_select ):
 
         m_ctx = dash.callback_context
         ( m_trigger_obj, m_trigger_src ) = m_ctx.triggered[0]['prop_id'].rsplit('.', 1)
 
+        # Only the selected graph changes, do not send the other figures back to the browser
+        def f_dash_selectedFigure( p_graph_select ):
+            return [ m_figure if m_index == p_graph_select else dash.no_update for ( m_index, m_figure ) in enumerate( s_graph_obj_figures ) ]
+
+        # Zooming, panning or autoranging the time axis replaces the trace data with the downsampled visible range
+        if( m_trigger_src == 'relayoutData' ):
+            m_graph_index = json.loads( m_trigger_obj )['index']
+            ( m_changed, m_range ) = f_relayout_range( p_relayoutData[m_graph_index] )
+            if( not m_changed ):
+                return [ [dash.no_update] * len(s_graph_obj_figures), dash.no_update, dash.no_update ]
+
+            m_figure = s_graph_obj_figures[m_graph_index]
+            for ( m_dataset, ( m_x, m_y ) ) in zip( m_figure['data'], g_trace_data[m_figure['layout']['yaxis']['title']['text']] ):
+                ( m_dataset['x'], m_dataset['y'] ) = f_zoom_trace( m_x, m_y, m_range, g_graph_max_points )
+
+            if( m_range is None ):
+                m_figure['layout']['xaxis'].pop( 'range', None )
+                m_figure['layout']['xaxis']['autorange'] = True
+            else:
+                m_figure['layout']['xaxis']['range']     = m_range
+                m_figure['layout']['xaxis']['autorange'] = False
+
+            return [ f_dash_selectedFigure( m_graph_index ), dash.no_update, dash.no_update ]
+
         if( m_trigger_src == 'restyleData' ):
             for m_iter in range(0,len(p_restyleData[s_graph_select][1])) :
                 (m_state, m_run) = (p_restyleData[s_graph_select][0], p_restyleData[s_graph_select][1])
@@ -395,7 +661,7 @@ def f_graph( p_loadgen_csv, p_power_csv, p_filter ):
                 else:
                     print( f"*** ERROR: restyleData = {p_restyleData}" )
 
-            return [ s_graph_obj_figures, s_loadgen_trigger, s_selected_trigger ]
+            return [ f_dash_selectedFigure( s_graph_select ), s_loadgen_trigger, s_selected_trigger ]
 
         m_filter_keywords = ""
         m_filter_run_id   = ""
@@ -426,7 +692,7 @@ def f_graph( p_loadgen_csv, p_power_csv, p_filter ):
                 m_dataset['visible'] = "legendonly"
                 m_shapes['visible']  = False
 
-        return [ s_graph_obj_figures, not s_loadgen_trigger, not s_selected_trigger ]
+        return [ f_dash_selectedFigure( s_graph_select ), not s_loadgen_trigger, not s_selected_trigger ]
 
         
 #### Toggle visibility of loadgen stats table        
@@ -471,53 +737,73 @@ def f_graph( p_loadgen_csv, p_power_csv, p_filter ):
         m_table_average    = [ html.Th( "Average"  ) ]
         m_table_dev        = [ html.Th( "Std.Dev"  ) ]
 
-        if( re.search( "\bwatts?\b|\bpower\b", m_figure['layout']['yaxis']['title']['text'], re.I ) ):
-        #if( m_figure['layout']['yaxis']['title']['text'] == 'Watts' ):
+        m_header = m_figure['layout']['yaxis']['title']['text']
+        m_energy = re.search( r"\bwatts?\b|\bpower\b", m_header, re.I )
+        if( m_energy ):
             m_table_energy = [ html.Th( "Energy"   ) ]
         
         m_dataframes       = defaultdict(dict)
         
         if( p_selectedData and p_selectedData[s_dropdown_graph_select] is not None ):
-            for m_point in p_selectedData[s_dropdown_graph_select]['points'] :
+            # The graphs only show downsampled data, so a box selection covers all the samples of its time range,
+            # answered from the trace summaries.  A lasso selection uses the selected points.
+            if( 'range' in p_selectedData[s_dropdown_graph_select] ):
+                ( m_begin, m_end ) = sorted( pandas.Timestamp( m_time ).to_datetime64() for m_time in p_selectedData[s_dropdown_graph_select]['range']['x'] )
+                for m_curve in range( len(g_trace_data[m_header]) ):
+
+                    if( m_figure['data'][m_curve]['visible'] != True ):
+                        continue
+
+                    m_stats = f_summary_stats( f_trace_summary( m_header, m_curve ), m_begin, m_end )
+                    if( m_stats is None ):
+                        continue
+
+                    m_dataframes[m_curve]['name']  = m_figure['data'][m_curve]['name']
+                    m_dataframes[m_curve]['stats'] = m_stats
+
+            else:
+                # Collect the points of each curve, then build its frame once
+                m_points = defaultdict( lambda: { 'x' : [], 'y' : [] } )
+                for m_point in p_selectedData[s_dropdown_graph_select]['points'] :
             
-                if( s_graph_obj_figures[s_dropdown_graph_select]['data'][m_point['curveNumber']]['visible'] != True ):
-                    continue
+                    if( s_graph_obj_figures[s_dropdown_graph_select]['data'][m_point['curveNumber']]['visible'] != True ):
+                        continue
                     
-                if( m_point['curveNumber'] not in m_dataframes ):
-                    m_dataframes[m_point['curveNumber']]['name'] = s_graph_obj_figures[s_dropdown_graph_select]['data'][m_point['curveNumber']]['name']
-                    m_dataframes[m_point['curveNumber']]['data'] = s_graph_obj_figures[s_dropdown_graph_select]['layout']['yaxis']['title']['text']
-                    m_dataframes[m_point['curveNumber']]['dataframe'] = pandas.DataFrame( {'x':[m_point['x']], 'y':[m_point['y']] } )
-                else:    
-                    m_dataframes[m_point['curveNumber']]['dataframe'] = m_dataframes[m_point['curveNumber']]['dataframe'].append( {'x':m_point['x'], 'y':m_point['y'] }, ignore_index=True )
+                    if( m_point['curveNumber'] not in m_dataframes ):
+                        m_dataframes[m_point['curveNumber']]['name'] = s_graph_obj_figures[s_dropdown_graph_select]['data'][m_point['curveNumber']]['name']
+                    m_points[m_point['curveNumber']]['x'].append( m_point['x'] )
+                    m_points[m_point['curveNumber']]['y'].append( m_point['y'] )
+
+                for m_key in m_points:
+                    m_dataframes[m_key]['stats'] = f_frame_stats( pandas.DataFrame( m_points[m_key] ) )
 
             if( not m_dataframes ):
                 return [ [], {'display':'block'} ]
                 
             for m_key in m_dataframes:
-                m_frame = m_dataframes[m_key]['dataframe']
+                ( m_samples, m_duration, m_min, m_max, m_mean, m_std ) = m_dataframes[m_key]['stats']
                 (m_run_id, m_workload, m_scenario, m_run_mode) = m_dataframes[m_key]['name'].split(", ")
                 
                 m_table_run_id.append( html.Td( f"{m_run_id}" ) )
                 m_table_workload.append( html.Td( f"{m_workload}" ) )
                 m_table_scenario.append( html.Td( f"{m_scenario}" ) )
                 m_table_run_mode.append( html.Td( f"{m_run_mode}" ) )
-                m_table_samples.append( html.Td( f"{m_frame.shape[0]}" ) )
-                m_duration = dateutil.parser.parse(m_frame['x'].max()) - dateutil.parser.parse(m_frame['x'].min())
+                m_table_samples.append( html.Td( f"{m_samples}" ) )
                 m_table_timedelta.append( html.Td( f"{(datetime(2011, 1, 13) + m_duration).strftime('%H:%M:%S.%f')[:-3]}" ) )
 
-                if( numpy.issubdtype(m_frame['y'].dtype, numpy.number ) ):
-                    m_table_average.append( html.Td( f"{m_frame['y'].mean():.3f}" ) )
-                    m_table_min.append( html.Td( f"{m_frame['y'].min():.3f}" ) )
-                    m_table_max.append( html.Td( f"{m_frame['y'].max():.3f}" ) )
-                    m_table_dev.append( html.Td( f"{m_frame['y'].std():.3f}" ) )
+                if( m_mean is not None ):
+                    m_table_average.append( html.Td( f"{m_mean:.3f}" ) )
+                    m_table_min.append( html.Td( f"{m_min:.3f}" ) )
+                    m_table_max.append( html.Td( f"{m_max:.3f}" ) )
+                    m_table_dev.append( html.Td( f"{m_std:.3f}" ) )
                 else:  
                     m_table_average.append( html.Td( "n/a" ) )
                     m_table_min.append( html.Td( "n/a" ) )
                     m_table_max.append( html.Td( "n/a" ) )
                     m_table_dev.append( html.Td( "n/a" ) )
                 
-                if( re.search( "watts?|power", m_dataframes[m_key]['data'], re.I ) ):
-                    m_table_energy.append( html.Td( f"{(m_frame['y'].mean() * (m_duration.seconds + m_duration.microseconds / 1000000)):.3f}" ) )
+                if( m_energy ):
+                    m_table_energy.append( html.Td( f"{(m_mean * (m_duration.seconds + m_duration.microseconds / 1000000)):.3f}" if m_mean is not None else "n/a" ) )
                 
                    
             m_ret = [ html.Tr( m_table_run_id   ),
@@ -531,7 +817,7 @@ def f_graph( p_loadgen_csv, p_power_csv, p_filter ):
                       html.Tr( m_table_average  ),
                       html.Tr( m_table_dev      ) ]
 
-            if( re.search( "watts?|power", m_dataframes[m_key]['data'], re.I ) ):
+            if( m_energy ):
                 m_ret.append( html.Tr( m_table_energy  ) )
                 
             return [ m_ret, {'display':'block'} ]
@@ -576,15 +862,15 @@ def f_graph( p_loadgen_csv, p_power_csv, p_filter ):
                 m_table_run_mode.append( html.Td( f"{m_run_mode}" ) )
                 m_table_metric.append( html.Td( f"{g_loadgen_data[m_iter]['Metric']}" ) )
                 m_table_score.append( html.Td( f"{g_loadgen_data[m_iter]['Score']}" ) )
-                m_table_samples.append( html.Td( f"{g_graph_data[m_iter].shape[0]}" ) )
-                m_duration = g_graph_data[m_iter]['Datetime'].max() - g_graph_data[m_iter]['Datetime'].min()
+                ( m_samples, m_duration, m_min, m_max, m_mean, m_std ) = f_loadgen_stats( m_figure['layout']['yaxis']['title']['text'], m_iter )
+                m_table_samples.append( html.Td( f"{m_samples}" ) )
                 m_table_duration.append( html.Td( f"{(datetime(2011, 1, 13) + m_duration).strftime('%H:%M:%S.%f')[:-3]}" ) )
 
-                if( numpy.issubdtype(g_graph_data[m_iter][m_figure['layout']['yaxis']['title']['text']].dtype, numpy.number ) ):
-                    m_table_average.append( html.Td( f"{g_graph_data[m_iter][m_figure['layout']['yaxis']['title']['text']].mean():.3f}" ) )
-                    m_table_min.append( html.Td( f"{g_graph_data[m_iter][m_figure['layout']['yaxis']['title']['text']].min():.3f}" ) )
-                    m_table_max.append( html.Td( f"{g_graph_data[m_iter][m_figure['layout']['yaxis']['title']['text']].max():.3f}" ) )
-                    m_table_dev.append( html.Td( f"{g_graph_data[m_iter][m_figure['layout']['yaxis']['title']['text']].std():.3f}" ) )
+                if( m_mean is not None ):
+                    m_table_average.append( html.Td( f"{m_mean:.3f}" ) )
+                    m_table_min.append( html.Td( f"{m_min:.3f}" ) )
+                    m_table_max.append( html.Td( f"{m_max:.3f}" ) )
+                    m_table_dev.append( html.Td( f"{m_std:.3f}" ) )
                 else:  
                     m_table_average.append( html.Td( "n/a" ) )
                     m_table_min.append( html.Td( "n/a" ) )
@@ -593,7 +879,7 @@ def f_graph( p_loadgen_csv, p_power_csv, p_filter ):
                 
                 
                 if( m_figure['layout']['yaxis']['title']['text'] == 'Watts' ):
-                    m_table_energy.append( html.Td( f"{(g_graph_data[m_iter][m_figure['layout']['yaxis']['title']['text']].mean() * (m_duration.seconds + m_duration.microseconds / 1000000)):.3f}" ) )
+                    m_table_energy.append( html.Td( f"{(m_mean * (m_duration.seconds + m_duration.microseconds / 1000000)):.3f}" ) )
 
             m_iter += 1
 
@@ -747,59 +1033,107 @@ def f_parse_Loadgen( p_dirin, p_fileout, p_custom_workloads ):
         exit(1)
 
 
+# Open a PTDaemon power log as text, decompressing gzip or zstd logs on the fly
+def f_open_SPECPowerlog( p_filein ):
+    m_file = open( p_filein, 'rb' )
+    m_magic = m_file.peek( 4 )[:4]
+
+    if( m_magic[:2] == b"\x1f\x8b" ):
+        return gzip.open( m_file, 'rt' )
+
+    if( m_magic == b"\x28\xb5\x2f\xfd" ):
+        try:
+            import zstandard
+        except ImportError:
+            m_file.close()
+            print( f"parseSPEC: zstandard module is required to read {p_filein}: pip install zstandard" )
+            exit(1)
+        return io.TextIOWrapper( zstandard.ZstdDecompressor().stream_reader( m_file ) )
+
+    return io.TextIOWrapper( m_file )
+
+
 #### Parse PTDaemon Power Log Filename (legacy support)
 #### Format should be:
 ####   Time,MM-DD-YYYY HH:MM:SS.mmm,Watts,D*.D*,Volts,D*.D*,Amps,D*.D*,PF,D*.D*,Mark,String
 #### Output format will be:
 ####   Date,Time,Watts,Volts,Amps,PF,Mark
 ####   YYYY-MM-DD,HH:MM:SS.mmm,D*.D*,D*.D*,D*.D*,D*.D*,String
+# Convert a PTDaemon power log to CSV, writing the rows as they are parsed
 def f_parse_SPECPowerlog( p_filein, p_fileout ):
     m_counter = 0
-    m_storage = []
 
     try:
         if( g_verbose ) : print( f"parseSPEC: opening power log file: {p_filein}" )
-        m_file = open( p_filein, 'r' )
+        m_file = f_open_SPECPowerlog( p_filein )
     except:
         print( f"parseSPEC: error opening power log file: {p_filein}" )
         exit(1)
 
-    # Create headers
-    m_storage.append( ["Date", "Time", "Watts", "Volts", "Amps", "PF", "Mark"] )
+    try:
+        if( g_verbose ) : print( f"parseSPEC: storing csv data into: {p_fileout}" )
+        m_fileout = open( p_fileout, 'w', newline='')
+    except:
+        print( f"parseSPEC: error while creating PTDaemon power log csv output file: {p_fileout}" )
+        exit(1)
 
-    # Store data
-    for m_line in m_file :
-    
-        if( not re.match("^Time,.*,Watts,.*,Volts,.*,Amps,.*,PF,.*,Mark,.*$", m_line ) ):
-            continue
-    
-        m_counter = m_counter + 1
-        m_line = m_line.strip()
-        m_line = m_line.replace( "Time", "Date", 1 )
-        m_line = m_line.replace( " ", ",Time,", 1)
-        m_line = m_line.split(',')[1::2]
+    with m_file, m_fileout:
+        m_csvWriter = csv.writer( m_fileout, delimiter=',' )
 
-        # need to re-order date to iso format
-        m_line[0] = m_line[0][-4:] + m_line[0][-5:-4] + m_line[0][:5]
+        # Create headers
+        m_csvWriter.writerow( ["Date", "Time", "Watts", "Volts", "Amps", "PF", "Mark"] )
 
-        m_storage.append( m_line )
+        # Parse a batch of whole lines at a time, column by column.  Only the total of multichannel analyzers is kept.
+        while True:
+            m_lines = m_file.readlines( g_specpower_batch_size )
+            if( not m_lines ):
+                break
 
-    m_file.close()
+            for m_block in ptd_log.tokenize( "".join( m_lines ), strict=False ):
+                m_counter = m_counter + m_block.rows
+                m_datetime = m_block.column(1)
+
+                # need to re-order date to iso format
+                m_date = [ m_dt[6:10] + "-" + m_dt[:5] for m_dt in m_datetime ]
+                m_time = [ m_dt[11:] for m_dt in m_datetime ]
+
+                m_csvWriter.writerows( zip( m_date, m_time, m_block.column(3), m_block.column(5),
+                                            m_block.column(7), m_block.column(9), m_block.column(11) ) )
 
     if( g_verbose ) : print( f"parseSPEC: done parsing PTDaemon power log.  {m_counter} entries processed" )
 
-    try:
-        if( g_verbose ) : print( f"parseSPEC: storing csv data into: {p_fileout}" )
-        with open( p_fileout, 'w', newline='') as m_file:
-            m_csvWriter = csv.writer( m_file, delimiter=',' )
+    return m_counter
 
-            for m_entry in m_storage:
-                m_csvWriter.writerow( m_entry )
-        m_file.close()
-    except:
-        print( f"parseSPEC: error while creating PTDaemon power log csv output file: {p_fileout}" )
-        exit(1)
 
+# Convert one or more PTDaemon power logs.  Multiple logs are converted in parallel, each into its own
+# partition of the output: power_out.csv becomes power_out_0.csv, power_out_1.csv, ...
+# Returns the list of CSV files written.
+def f_parse_SPECPowerlogs( p_filesin, p_fileout, p_jobs ):
+    if( len(p_filesin) == 1 ):
+        f_parse_SPECPowerlog( p_filesin[0], p_fileout )
+        return [p_fileout]
+
+    m_root, m_ext = os.path.splitext( p_fileout )
+    m_filesout = [ f"{m_root}_{m_index}{m_ext}" for m_index in range(len(p_filesin)) ]
+
+    with ProcessPoolExecutor( max_workers=p_jobs, initializer=f_set_verbose, initargs=(g_verbose,) ) as m_executor:
+        for m_filein, m_fileout, m_counter in zip( p_filesin, m_filesout,
+                                                   m_executor.map( f_parse_SPECPowerlog, p_filesin, m_filesout ) ):
+            if( g_verbose ) : print( f"parseSPEC: {m_filein}: {m_counter} entries stored into {m_fileout}" )
+
+    return m_filesout
+
+
+def f_set_verbose( p_verbose ):
+    global g_verbose
+    g_verbose = p_verbose
+
+
+# Read a CSV file, or the partitions of it written by f_parse_SPECPowerlogs()
+def f_read_csv( p_files ):
+    if( isinstance( p_files, str ) ):
+        return pandas.read_csv( p_files )
+    return pandas.concat( [ pandas.read_csv( m_file ) for m_file in p_files ], ignore_index=True )
 
 
 def f_parseParameters():
@@ -812,8 +1146,9 @@ def f_parseParameters():
     # Inputs
     m_argparser.add_argument( "-lgi", "--loadgen_in",   help="Specify directory of loadgen log files to parase from",
                                                         default="" )
-    m_argparser.add_argument( "-spl", "--specpower_in", help="Specify PTDaemon power log file (in custom PTD format)",
-                                                        default="" )
+    m_argparser.add_argument( "-spl", "--specpower_in", help="Specify PTDaemon power log file(s) (in custom PTD format, may be gzip or zstd compressed)",
+                                                        nargs="+",
+                                                        default=[] )
     m_argparser.add_argument( "-pli", "--powerlog_in",  help="Specify power or data input file (in CSV format)",
                                                         default="" )
 
@@ -836,6 +1171,10 @@ def f_parseParameters():
     m_argparser.add_argument( "-w",   "--workload",     help="Parse for workloads other than [mobilenet, gnmt, resenet50/resnet, ssd-large/ssdresnet34, or ssd-small/ssdmobilenet]",
                                                         nargs="+" )
 
+    m_argparser.add_argument( "-j",   "--jobs",         help="Number of PTDaemon power logs to convert in parallel (default: number of CPUs)",
+                                                        type=int,
+                                                        default=os.cpu_count() )
+
     m_argparser.add_argument( "-v",   "--verbose",      action="store_true" )
 
                                                         
@@ -854,11 +1193,11 @@ def f_parseParameters():
     if( m_args.workload ):
         m_args.workload = list(dict.fromkeys(m_args.workload))
 
-    if( m_args.specpower_in == m_args.powerlog_out ):
+    if( m_args.powerlog_out in m_args.specpower_in ):
         print( "**** ERROR: Power log output file cannot be the same as power log input file!" )
         exit(1)
 
-    if( m_args.specpower_in != "" and m_args.powerlog_in != "" and m_args.graph ):
+    if( m_args.specpower_in and m_args.powerlog_in != "" and m_args.graph ):
         print( "**** ERROR: Only one set of power data can be graphed." )
         exit(1)
 
@@ -866,7 +1205,7 @@ def f_parseParameters():
         m_args.powerlog_in = m_args.powerlog_out
 
     if( m_args.graph ) :
-        if( m_args.powerlog_in is None and m_args.powerlog_out is None and m_args.specpower_in is None ) :
+        if( m_args.powerlog_in is None and m_args.powerlog_out is None and not m_args.specpower_in ) :
             print( "**** ERROR: Need power/data log to graph" )
             exit(1)
         if( m_args.loadgen_in is None and m_args.loadgen_out is None ) :
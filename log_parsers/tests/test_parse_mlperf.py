@@ -0,0 +1,213 @@
+# Copyright 2018 The MLPerf Authors. All Rights Reserved.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+# =============================================================================
+
+# Run from the repository root: python -m pytest log_parsers
+
+from pathlib import Path
+import sys
+
+import pytest
+
+numpy = pytest.importorskip("numpy")
+pandas = pytest.importorskip("pandas")
+pytest.importorskip("dash")
+
+sys.path.insert(0, str(Path(__file__).resolve().parents[1]))
+import parse_mlperf  # noqa: E402
+
+
+def times(count: int) -> "numpy.ndarray":
+    start = numpy.datetime64("2021-01-22T15:00:00", "ns")
+    return start + numpy.arange(count) * numpy.timedelta64(1, "s")
+
+
+def test_downsample() -> None:
+    rng = numpy.random.default_rng(1)
+    x = numpy.arange(10007)
+    y = rng.normal(size=len(x))
+    y[[5, 500]] = numpy.nan
+    y[1234], y[4321] = 100.0, -100.0
+
+    dx, dy = parse_mlperf.f_downsample(x, y, 200)
+    assert len(dx) <= 200
+    assert dx[0] == 0 and dx[-1] == len(x) - 1
+    assert (numpy.diff(dx) > 0).all()
+    assert numpy.array_equal(dy, y[dx], equal_nan=True)
+    assert 100.0 in dy and -100.0 in dy
+
+    # The minimum and the maximum of every bucket are kept.
+    buckets = (200 - 2) // 2
+    size = -(-len(x) // buckets)
+    for begin in range(0, len(x), size):
+        bucket = y[begin : begin + size]
+        assert numpy.nanmin(bucket) in dy
+        assert numpy.nanmax(bucket) in dy
+
+    # Traces just over the limit, whose last buckets would be only padding
+    for count in [201, 202, 250, 399]:
+        dx, dy = parse_mlperf.f_downsample(x[:count], y[:count], 200)
+        assert len(dx) <= 200
+        assert dx[0] == 0 and dx[-1] == count - 1
+        assert numpy.array_equal(dy, y[dx], equal_nan=True)
+
+    dx, dy = parse_mlperf.f_downsample(x, numpy.full(len(x), numpy.nan), 200)
+    assert len(dx) <= 200
+    assert dx[0] == 0 and dx[-1] == len(x) - 1
+    assert numpy.isnan(dy).all()
+
+    # Short traces are not changed.
+    dx, dy = parse_mlperf.f_downsample(x[:200], y[:200], 200)
+    assert numpy.array_equal(dx, x[:200])
+
+    # Non-numeric data is strided.
+    labels = numpy.array([f"s{i}" for i in range(len(x))], dtype=object)
+    dx, dy = parse_mlperf.f_downsample(x, labels, 200)
+    assert len(dx) <= 200
+    assert dx[0] == 0 and dx[-1] == len(x) - 1
+    assert list(dy) == [f"s{i}" for i in dx]
+
+
+def test_zoom_trace() -> None:
+    x = times(1000)
+    y = numpy.arange(1000, dtype=numpy.float64)
+
+    begin, end = "2021-01-22 15:01:00", "2021-01-22 15:02:00.5"
+    dx, dy = parse_mlperf.f_zoom_trace(x, y, [begin, end], 1000)
+    inside = numpy.nonzero(
+        (x >= pandas.Timestamp(begin).to_datetime64())
+        & (x <= pandas.Timestamp(end).to_datetime64())
+    )[0]
+    # One sample more on each side.
+    assert numpy.array_equal(dx, x[inside[0] - 1 : inside[-1] + 2])
+    assert numpy.array_equal(dy, y[inside[0] - 1 : inside[-1] + 2])
+
+    dx, dy = parse_mlperf.f_zoom_trace(
+        x, y, ["2021-01-22 14:00:00", "2021-01-22 16:00:00"], 1000
+    )
+    assert numpy.array_equal(dx, x)
+
+    dx, dy = parse_mlperf.f_zoom_trace(x, y, None, 100)
+    assert len(dx) <= 100
+    assert dx[0] == x[0] and dx[-1] == x[-1]
+
+
+def test_relayout_range() -> None:
+    assert parse_mlperf.f_relayout_range(None) == (False, None)
+    assert parse_mlperf.f_relayout_range({"xaxis.autorange": True}) == (True, None)
+    assert parse_mlperf.f_relayout_range({"yaxis.range[0]": 1}) == (False, None)
+    assert parse_mlperf.f_relayout_range(
+        {"xaxis.range[0]": "a", "xaxis.range[1]": "b"}
+    ) == (True, ["a", "b"])
+    assert parse_mlperf.f_relayout_range({"xaxis.range": ("a", "b")}) == (
+        True,
+        ["a", "b"],
+    )
+
+
+def random_values(rng: "numpy.random.Generator", count: int) -> "numpy.ndarray":
+    values = rng.normal(100.0, 5.0, size=count)
+    values[rng.random(count) < 0.1] = numpy.nan
+    return values
+
+
+def assert_describe(stats: tuple, values: "numpy.ndarray") -> None:
+    """Compare (minimum, maximum, mean, std.dev) with pandas' describe()."""
+    expected = pandas.Series(values, dtype=numpy.float64).describe()
+    assert numpy.allclose(
+        stats,
+        [expected["min"], expected["max"], expected["mean"], expected["std"]],
+        equal_nan=True,
+    )
+
+
+def test_segment_stats() -> None:
+    rng = numpy.random.default_rng(2)
+    values = random_values(rng, 50)
+    lo = numpy.array([0, 0, 10, 49, 50, 20, 7, 30, 0])
+    hi = numpy.array([50, 0, 11, 50, 50, 45, 7, 31, 1])
+    values[30] = numpy.nan  # a single NaN sample
+
+    stats = parse_mlperf.f_segment_stats(values, lo, hi)
+    for i in range(len(lo)):
+        assert_describe([stat[i] for stat in stats], values[lo[i] : hi[i]])
+
+    for _ in range(20):
+        lo = rng.integers(0, len(values) + 1, size=30)
+        hi = numpy.minimum(lo + rng.integers(0, 5, size=30), len(values))
+        stats = parse_mlperf.f_segment_stats(values, lo, hi)
+        for i in range(len(lo)):
+            assert_describe([stat[i] for stat in stats], values[lo[i] : hi[i]])
+
+    stats = parse_mlperf.f_segment_stats(values, [], [])
+    assert [len(stat) for stat in stats] == [0, 0, 0, 0]
+
+    # All-NaN data
+    values = numpy.full(10, numpy.nan)
+    lo, hi = numpy.array([0, 3, 9, 10]), numpy.array([10, 4, 10, 10])
+    stats = parse_mlperf.f_segment_stats(values, lo, hi)
+    for i in range(len(lo)):
+        assert_describe([stat[i] for stat in stats], values[lo[i] : hi[i]])
+
+
+def test_segment_tree() -> None:
+    rng = numpy.random.default_rng(3)
+    for count in range(10):
+        values = random_values(rng, count)
+        for ufunc, naive in [(numpy.fmin, min), (numpy.fmax, max)]:
+            tree = parse_mlperf.f_segment_tree(values, ufunc)
+            for lo in range(count):
+                for hi in range(lo + 1, count + 1):
+                    valid = [v for v in values[lo:hi] if not numpy.isnan(v)]
+                    result = parse_mlperf.f_segment_query(tree, ufunc, lo, hi)
+                    if valid:
+                        assert result == naive(valid)
+                    else:
+                        assert numpy.isnan(result)
+
+    values = numpy.full(5, numpy.nan)
+    tree = parse_mlperf.f_segment_tree(values, numpy.fmin)
+    assert numpy.isnan(parse_mlperf.f_segment_query(tree, numpy.fmin, 0, 5))
+
+
+def test_summary_stats() -> None:
+    rng = numpy.random.default_rng(4)
+    x = times(200)
+    y = random_values(rng, 200)
+    summary = parse_mlperf.f_build_summary(x, y)
+
+    ranges = [(0, 200), (0, 1), (199, 200), (50, 51), (10, 90)]
+    ranges += [tuple(sorted(rng.integers(0, 201, size=2))) for _ in range(30)]
+    for lo, hi in ranges:
+        if lo >= hi:
+            continue
+        stats = parse_mlperf.f_summary_stats(summary, x[lo], x[hi - 1])
+        assert stats is not None
+        assert stats[0] == hi - lo
+        assert stats[1] == pandas.Timedelta(x[hi - 1] - x[lo]).to_pytimedelta()
+        assert_describe(stats[2:], y[lo:hi])
+
+    # No samples between the times.
+    half = numpy.timedelta64(500, "ms")
+    assert parse_mlperf.f_summary_stats(summary, x[5] + half, x[6] - half) is None
+
+    # All-NaN data
+    summary = parse_mlperf.f_build_summary(x, numpy.full(200, numpy.nan))
+    stats = parse_mlperf.f_summary_stats(summary, x[10], x[19])
+    assert stats is not None and stats[0] == 10
+    assert numpy.isnan(stats[2:]).all()
+
+    labels = numpy.array(["a"] * 200, dtype=object)
+    summary = parse_mlperf.f_build_summary(x, labels)
+    assert parse_mlperf.f_summary_stats(summary, x[0], x[9])[2:] == (None,) * 4
@@ -15,19 +15,23 @@
 
 
 from ptd_client_server.lib import common
+from ptd_client_server.lib import loadgen_log
+from ptd_client_server.lib import source_hashes
 from ptd_client_server.lib import summary as summarylib
 from ptd_client_server.lib import time_sync
-from datetime import datetime, timezone
 from pathlib import Path
-from typing import Optional
+from typing import Any, Callable, Dict, List, Optional, Set, Tuple
 import argparse
 import base64
+import concurrent.futures
+import hashlib
 import logging
 import os
-import re
 import shutil
 import socket
 import subprocess
+import sys
+import threading
 import time
 import uuid
 import zipfile
@@ -61,16 +65,30 @@ class CommandSender:
     def upload(self, command: str, fname: str) -> None:
         time_command = time.time()
         self._server.send(command)
-        self._server.send_file(fname)
+        known = self._server.send_file(fname)
         response = self._server.recv()
         time_response = time.time()
         logging.info(f"Got response: {response!r}")
         self._summary.message((command, time_command), (response, time_response))
+        if known is not None:
+            self._summary.add_known_hash(fname, known)
+
+    def upload_stream(self, command: str, dirname: str) -> None:
+        time_command = time.time()
+        self._server.send(command)
+        sent = self._server.send_dir(dirname)
+        response = self._server.recv()
+        time_response = time.time()
+        logging.info(f"Got response: {response!r}")
+        self._summary.message((command, time_command), (response, time_response))
+        for relpath, sha1 in sent.items():
+            self._summary.known_hash(os.path.join(dirname, relpath), sha1)
 
     def download(self, command: str, fname: str) -> None:
         logging.info(f"Fetching file {fname!r}")
         self._server.send(command)
-        self._server.recv_file(fname)
+        sha1 = self._server.recv_file(fname)
+        self._summary.known_hash(fname, sha1)
 
 
 def check_paths(loadgen_logs: str, output: str, force: bool) -> None:
@@ -105,6 +123,62 @@ def command_get_file(server: common.Proto, command: str, save_name: str) -> None
     logging.info(f"Saving response to {save_name!r}")
 
 
+# The ioctl cloning a file on Linux, _IOW(0x94, 9, int) from <linux/fs.h>.
+FICLONE = 0x40049409
+
+
+def copy_log(src: str, dst: str) -> Tuple[str, Optional[str]]:
+    """Copy src into the new file dst without writing the data again if the
+    file system allows: as a reflink sharing the blocks of src, or with
+    copy_file_range(), which the file system may offload.  Otherwise, fall back
+    to a streaming copy.  Return the method used and, for the streaming copy,
+    SHA-1 of the data.
+
+    Hardlinks are not used: the workload of the next phase could overwrite the
+    log in INDIR in place, changing the copy too.
+    """
+    with open(src, "rb") as fsrc, open(dst, "xb") as fdst:
+        if sys.platform == "linux":
+            import fcntl
+
+            try:
+                fcntl.ioctl(fdst.fileno(), FICLONE, fsrc.fileno())
+                return "reflink", None
+            except OSError:
+                pass
+
+        # Python 3.8+ on Linux
+        copy_file_range: Any = getattr(os, "copy_file_range", None)
+        if copy_file_range is not None:
+            size = os.fstat(fsrc.fileno()).st_size
+            offset = 0
+            try:
+                while offset < size:
+                    n = copy_file_range(
+                        fsrc.fileno(), fdst.fileno(), size - offset, offset, offset
+                    )
+                    if n == 0:
+                        break
+                    offset += n
+            except OSError:
+                pass
+            if offset == size:
+                return "copy_file_range", None
+            fdst.truncate(0)
+
+        sha1 = hashlib.sha1()
+        buf = memoryview(bytearray(common.FILE_CHUNK_SIZE))
+        fsrc.seek(0)
+        fdst.seek(0)
+        while True:
+            n = fsrc.readinto(buf)
+            if n == 0:
+                break
+            sha1.update(buf[:n])
+            fdst.write(buf[:n])
+    return "stream", sha1.hexdigest()
+
+
 def create_zip(zip_filename: str, dirname: str) -> None:
     with zipfile.ZipFile(zip_filename, "x", zipfile.ZIP_DEFLATED) as zf:
         for folderName, subfolders, filenames in os.walk(dirname):
@@ -114,43 +188,224 @@ def create_zip(zip_filename: str, dirname: str) -> None:
                 zf.write(filePath, zipPath)
 
 
-def get_time_from_line(
-    line: str, data_regexp: str, file: str, timezone_offset: int
-) -> Optional[float]:
-    # TODO: deduplicate with check.py?
-    log_time_str = re.search(data_regexp, line)
-    if log_time_str and log_time_str.group(0):
-        log_datetime = datetime.strptime(log_time_str.group(0), "%m-%d-%Y %H:%M:%S.%f")
-        return log_datetime.replace(tzinfo=timezone.utc).timestamp() + timezone_offset
-    return None
+class PhaseLogs:
+    """Copies, packs and uploads the loadgen logs of the finished phases.
+
+    In the background mode, the copying, hashing and packing of a phase run on
+    a worker thread as soon as the phase is stopped, while the next phase is
+    being started.  start_uploads() waits for them, so the next workload does
+    not write into INDIR while its logs are copied, and queues the upload to
+    run during the next workload.  The main thread sends no commands between
+    start_uploads() and wait(), so the two threads never use the connection at
+    the same time, and the messages are recorded in the same order as the
+    server receives them.
+    """
+
+    def __init__(
+        self,
+        command: CommandSender,
+        summary: summarylib.Summary,
+        session: str,
+        send_logs: bool,
+        stream_logs: bool,
+        background: bool,
+    ) -> None:
+        self._command = command
+        self._summary = summary
+        self._session = session
+        self._send_logs = send_logs or stream_logs
+        self._stream_logs = stream_logs
+        self._executor: Optional[concurrent.futures.ThreadPoolExecutor] = None
+        if background:
+            self._executor = concurrent.futures.ThreadPoolExecutor(
+                max_workers=1,
+                initializer=common.log_redirect.start,
+                initargs=(threading.get_ident(),),
+            )
+        self._futures: List["concurrent.futures.Future[None]"] = []
+        self._uploads: List[Tuple[str, str]] = []
+
+    def finish(self, mode: str, loadgen_logs: str, out: str) -> None:
+        """Copy the loadgen logs of the phase into out and upload them, or
+        queue the upload in the background mode."""
+        self._run(self._prepare, loadgen_logs, out)
+        if self._send_logs:
+            if self._executor is None:
+                self._upload(mode, out)
+            else:
+                self._uploads.append((mode, out))
+
+    def start_uploads(self) -> None:
+        """Wait for the copying and packing, then queue the uploads."""
+        self.wait()
+        for mode, out in self._uploads:
+            self._run(self._upload, mode, out)
+        self._uploads = []
+
+    def wait(self) -> None:
+        """Wait for the queued work, re-raising its exceptions."""
+        futures, self._futures = self._futures, []
+        for future in futures:
+            future.result()
+
+    def close(self) -> None:
+        self.start_uploads()
+        self.wait()
+        if self._executor is not None:
+            self._executor.submit(common.log_redirect.stop).result()
+            self._executor.shutdown()
+            self._executor = None
+
+    def _run(self, func: Callable[..., None], *args: str) -> None:
+        if self._executor is None:
+            func(*args)
+        else:
+            self._futures.append(self._executor.submit(func, *args))
+
+    def _prepare(self, loadgen_logs: str, out: str) -> None:
+        logging.info(f"Copying loadgen logs from {loadgen_logs!r} to {out!r}")
+        os.mkdir(out)
+        for file in [LOADGEN_LOG_FILE] + LOADGEN_OTHER_FILES:
+            src = os.path.join(loadgen_logs, file)
+            dest = os.path.join(out, file)
+            time_start = time.monotonic()
+            method, sha1 = copy_log(src, dest)
+            seconds = time.monotonic() - time_start
+            shutil.copymode(src, dest)
+            size = os.stat(dest).st_size
+            logging.info(
+                f"Copied {file!r} ({common.human_bytes(size)}) "
+                f"in {seconds:.3f} seconds using {method}"
+            )
+            self._summary.logs_copy(
+                f"{os.path.basename(out)}/{file}", size, seconds, method
+            )
+            if sha1 is None:
+                sha1 = source_hashes.hash_file(dest)
+            self._summary.known_hash(dest, sha1)
+
+        if self._send_logs and not self._stream_logs:
+            logging.info("Packing logs into zip")
+            create_zip(f"{out}.zip", out)
+            logging.info(
+                "Zip file size: " + common.human_bytes(os.stat(f"{out}.zip").st_size)
+            )
+
+    def _upload(self, mode: str, out: str) -> None:
+        if self._stream_logs:
+            logging.info(f"Streaming {mode} logs to the server")
+            command = f"session,{self._session},upload_stream,{mode}"
+            self._command.upload_stream(command, out)
+        else:
+            logging.info(f"Uploading {mode} logs to the server")
+            command = f"session,{self._session},upload,{mode}"
+            self._command.upload(command, f"{out}.zip")
+            os.remove(f"{out}.zip")
+
+
+# A directory or file modified this close to the snapshot is examined again
+# anyway: it could have been modified after the snapshot without changing the
+# mtime, if the file system has a coarse time resolution.
+MTIME_SLACK_NS = 2 * 10 ** 9
+
+
+class LoadgenLogsIndex:
+    """Snapshot of the loadgen logs directory tree, taken before the workload
+    runs, so that only the loadgen logs created or modified by the workload are
+    examined after it, instead of every log of the previous runs.
+
+    A new file changes the mtime of its directory, so the directories with the
+    same mtime as in the snapshot are not listed again, only their already
+    known loadgen logs and subdirectories are checked.
+    """
+
+    def __init__(self, path: str) -> None:
+        self._path = os.path.abspath(path)
+        self._time_ns = time.time_ns()
+        # Directory -> (mtime_ns, subdirectories, loadgen logs in it)
+        self._dirs: Dict[str, Tuple[int, List[str], List[str]]] = {}
+        # Loadgen log -> (mtime_ns, size)
+        self._files: Dict[str, Tuple[int, int]] = {}
+        self._walk(snapshot=True)
+
+    def changed_files(self) -> List[str]:
+        """Return the loadgen logs created or modified since the snapshot."""
+        return self._walk(snapshot=False)
+
+    def _walk(self, snapshot: bool) -> List[str]:
+        changed: List[str] = []
+        visited: Set[Tuple[int, int]] = set()
+        stack = [self._path]
+        while stack:
+            dirname = stack.pop()
+            try:
+                st = os.stat(dirname)
+            except OSError:
+                continue
+            if (st.st_dev, st.st_ino) in visited:
+                continue  # a symlink loop
+            visited.add((st.st_dev, st.st_ino))
+
+            known = self._dirs.get(dirname)
+            if (
+                not snapshot
+                and known is not None
+                and known[0] == st.st_mtime_ns
+                and self._time_ns - st.st_mtime_ns > MTIME_SLACK_NS
+            ):
+                subdirs, files = known[1], known[2]
+            else:
+                subdirs, files = self._scandir(dirname)
+                if snapshot:
+                    self._dirs[dirname] = (st.st_mtime_ns, subdirs, files)
+            stack.extend(reversed(subdirs))
+
+            for fname in files:
+                try:
+                    st = os.stat(fname)
+                except OSError:
+                    continue
+                key = (st.st_mtime_ns, st.st_size)
+                if snapshot:
+                    self._files[fname] = key
+                elif (
+                    self._files.get(fname) != key
+                    or self._time_ns - st.st_mtime_ns <= MTIME_SLACK_NS
+                ):
+                    changed.append(fname)
+        return changed
+
+    @staticmethod
+    def _scandir(dirname: str) -> Tuple[List[str], List[str]]:
+        subdirs: List[str] = []
+        files: List[str] = []
+        try:
+            with os.scandir(dirname) as it:
+                for entry in it:
+                    if entry.is_dir():
+                        subdirs.append(entry.path)
+                    elif entry.name == LOADGEN_LOG_FILE:
+                        files.append(entry.path)
+        except OSError:
+            pass
+        return sorted(subdirs), sorted(files)
 
 
 def find_loadgen_logs(
-    path: str, timezone_offset: int, time_load_start: float, time_load_end: float
+    path: str,
+    timezone_offset: int,
+    time_load_start: float,
+    time_load_end: float,
+    candidates: Optional[List[str]] = None,
 ) -> Optional[str]:
-    abs_path = path if os.path.isabs(path) else os.path.abspath(path)
-    loadgen_logs_candidates = list(Path(abs_path).rglob(LOADGEN_LOG_FILE))
-    for file in loadgen_logs_candidates:
-        power_begin = None
-        power_end = None
-        with open(file) as f:
-            for line in f:
-                if re.search("power_begin", line.lower()):
-                    power_begin = get_time_from_line(
-                        line,
-                        r"(\d*-\d*-\d* \d*:\d*:\d*\.\d*)",
-                        str(file),
-                        timezone_offset,
-                    )
-                elif re.search("power_end", line.lower()):
-                    power_end = get_time_from_line(
-                        line,
-                        r"(\d*-\d*-\d* \d*:\d*:\d*\.\d*)",
-                        str(file),
-                        timezone_offset,
-                    )
-                if power_begin and power_end:
-                    break
+    """Find the directory of the loadgen logs of the run between
+    time_load_start and time_load_end among the candidates, or among all the
+    loadgen logs in path if candidates is None."""
+    if candidates is None:
+        abs_path = path if os.path.isabs(path) else os.path.abspath(path)
+        candidates = [str(file) for file in Path(abs_path).rglob(LOADGEN_LOG_FILE)]
+    for file in candidates:
+        power_begin, power_end = loadgen_log.power_times(file, timezone_offset)
         if (
             power_begin
             and power_end
@@ -207,6 +462,12 @@ def main() -> None:
     parser.add_argument(
         "-s", "--send-logs", action="store_true",
         help="send loadgen logs to the server")
+    parser.add_argument(
+        "--stream-logs", action="store_true",
+        help="send loadgen logs without creating zip files (implies -s)")
+    parser.add_argument(
+        "--background-logs", action="store_true",
+        help="copy, pack and upload the ranging logs during the testing run")
     parser.add_argument(
         "-F", "--fetch-logs", action="store_true",
         help="fetch logs from the server")
@@ -216,6 +477,12 @@ def main() -> None:
     parser.add_argument(
         "-S", "--stop-server", action="store_true",
         help="stop the server after processing this client")
+    parser.add_argument(
+        "--analyzer", metavar="NAME", type=str, default="",
+        help="use the analyzer from the [ptd.NAME] section of the server config")
+    parser.add_argument(
+        "--transport", choices=list(common.TRANSPORTS), default="select",
+        help="connection implementation, defaults to select")
     # fmt: on
     common.log_redirect.start()
 
@@ -227,6 +494,9 @@ def main() -> None:
             "invalid --label value: {args.label!r}. Should be alphanumeric or -_."
         )
 
+    if not common.check_label(args.analyzer):
+        parser.error(f"invalid --analyzer value: {args.analyzer!r}.")
+
     if args.port is None:
         args.port = common.DEFAULT_PORT
         logging.warning(f"Assuming default port (--port {common.DEFAULT_PORT}")
@@ -243,7 +513,7 @@ def main() -> None:
         logging.fatal(f"Could not connect to the server {args.addr}:{args.port} {e}")
         exit(1)
 
-    serv = common.Proto(s)
+    serv = common.TRANSPORTS[args.transport](s)
     serv.enable_keepalive()
 
     summary = summarylib.Summary()
@@ -277,7 +547,10 @@ def main() -> None:
 
     summary.client_uuid = uuid.uuid4()
     try:
-        session = command(f"new,{args.label},{summary.client_uuid}")
+        session = command(
+            f"new,{args.label},{summary.client_uuid}"
+            + (f",{args.analyzer}" if args.analyzer else "")
+        )
         if session is None or not session.startswith("OK "):
             logging.fatal("Could not start new session")
             exit(1)
@@ -294,14 +567,27 @@ def main() -> None:
     os.mkdir(out_dir)
     os.mkdir(power_dir)
 
+    logs = PhaseLogs(
+        command,
+        summary,
+        session,
+        args.send_logs,
+        args.stream_logs,
+        args.background_logs,
+    )
+
     for mode in ["ranging", "testing"]:
         logging.info(f"Running workload in {mode} mode")
         out = os.path.join(out_dir, "run_1" if mode == "testing" else mode)
 
+        logs_index = LoadgenLogsIndex(args.loadgen_logs)
+
         sync_check()
 
         summary.phase(mode, 0)
         command(f"session,{session},start,{mode}", check=True)
+        # Before the workload writes into INDIR again.
+        logs.start_uploads()
 
         summary.phase(mode, 1)
         logging.info(f"Running the workload {args.run_workload!r}")
@@ -310,12 +596,27 @@ def main() -> None:
         time_load_end = time.time()
         summary.phase(mode, 2)
 
+        logs.wait()
+
         command(f"session,{session},stop,{mode}", check=True)
         summary.phase(mode, 3)
 
         loadgen_logs = find_loadgen_logs(
-            args.loadgen_logs, summary.timezone_offset, time_load_start, time_load_end
+            args.loadgen_logs,
+            summary.timezone_offset,
+            time_load_start,
+            time_load_end,
+            logs_index.changed_files(),
         )
+        if not loadgen_logs:
+            # E.g. the workload copied the logs preserving their mtime.
+            logging.info("Searching all the loadgen logs")
+            loadgen_logs = find_loadgen_logs(
+                args.loadgen_logs,
+                summary.timezone_offset,
+                time_load_start,
+                time_load_end,
+            )
 
         if not loadgen_logs:
             logging.fatal(
@@ -327,20 +628,9 @@ def main() -> None:
             )
             exit(1)
 
-        logging.info(f"Copying loadgen logs from {loadgen_logs!r} to {out!r}")
-        os.mkdir(out)
-        for file in [LOADGEN_LOG_FILE] + LOADGEN_OTHER_FILES:
-            shutil.copy(os.path.join(loadgen_logs, file), out)
-
-        if args.send_logs:
-            logging.info("Packing logs into zip and uploading to the server")
-            create_zip(f"{out}.zip", out)
-            logging.info(
-                "Zip file size: " + common.human_bytes(os.stat(f"{out}.zip").st_size)
-            )
-            command.upload(f"session,{session},upload,{mode}", f"{out}.zip")
-            os.remove(f"{out}.zip")
+        logs.finish(mode, loadgen_logs, out)
 
+    logs.close()
     logging.info("Done runs")
 
     client_log_path = os.path.join(power_dir, "client.log")
@@ -363,4 +653,5 @@ def main() -> None:
                 f"download,{session},{fname}", os.path.join(out_dir, fname)
             )
 
+    serv.close()
     logging.info("Successful exit")
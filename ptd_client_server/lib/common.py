@@ -13,7 +13,21 @@
 # limitations under the License.
 # =============================================================================
 
-from typing import Any, Callable, Optional, List
+from pathlib import Path
+from typing import (
+    Any,
+    BinaryIO,
+    Callable,
+    Coroutine,
+    Dict,
+    Optional,
+    List,
+    Set,
+    Type,
+    TypeVar,
+)
+import asyncio
+import hashlib
 import json
 import logging
 import os
@@ -23,7 +37,9 @@ import socket
 import socketserver
 import string
 import sys
+import threading
 import time
+import zlib
 
 from ptd_client_server.lib import source_hashes
 
@@ -44,15 +60,35 @@ FETCH_FILES_LIST = [
     "run_1/spl.txt",
 ]
 
+# Max length of a chunk in send_file().  Older receivers keep a whole chunk
+# in memory.
+FILE_CHUNK_SIZE = 1024 * 1024
+
+# Max length of a compressed chunk accepted by recv_dir().
+MAX_COMPRESSED_CHUNK_SIZE = 16 * 1024 * 1024
+
+
+def safe_join(dirname: str, relpath: str) -> Optional[str]:
+    """Join a relative path received from the peer to dirname.  Return None if
+    the path could point outside of dirname."""
+    parts = relpath.split("/")
+    for part in parts:
+        if part in ("", ".", "..") or "\\" in part or ":" in part:
+            return None
+    return os.path.join(dirname, *parts)
+
+
+_P = TypeVar("_P", bound="Proto")
+
 
 class Proto:
     # TODO: escape/unescape binary data?
 
     def __init__(self, conn: socket.socket) -> None:
-        self._buf = b""
+        self._buf = bytearray()
         self._x: Optional[socket.socket] = conn
 
-    def _recv_buf(self, buflen: int) -> bytes:
+    def _wait_readable(self) -> None:
         assert self._x is not None
         # Issue: https://bugs.python.org/issue41437
         #        SIGINT blocked by socket operations like recv on Windows
@@ -61,7 +97,25 @@ class Proto:
         while True:
             ready = select.select([self._x], [], [], 1)
             if ready[0]:
-                return self._x.recv(buflen)
+                return
+
+    def _recv_buf(self, buflen: int) -> bytes:
+        assert self._x is not None
+        self._wait_readable()
+        return self._x.recv(buflen)
+
+    def _recv_buf_into(self, buf: memoryview) -> int:
+        assert self._x is not None
+        self._wait_readable()
+        return self._x.recv_into(buf)
+
+    def _take_buf(self, buf: memoryview) -> int:
+        """Move the already received data into buf."""
+        n = min(len(buf), len(self._buf))
+        if n > 0:
+            buf[:n] = self._buf[:n]
+            del self._buf[:n]
+        return n
 
     def recv(self) -> Optional[str]:
         if self._x is None:
@@ -78,7 +132,7 @@ class Proto:
 
         idx = self._buf.index(b"\n")
         result = self._buf[:idx].rstrip(b"\r")
-        self._buf = self._buf[idx + len(b"\n") :]
+        del self._buf[: idx + len(b"\n")]
         return result.decode(errors="replace")
 
     def send(self, data: str) -> None:
@@ -96,7 +150,10 @@ class Proto:
         self.send(data)
         return self.recv()
 
-    def recv_file(self, filename: str) -> None:
+    def recv_file(self, filename: str) -> str:
+        """Receive a file sent by send_file().  Return SHA-1 of its content."""
+        buf = memoryview(bytearray(FILE_CHUNK_SIZE))
+        sha1 = hashlib.sha1()
         with open(filename + ".tmp", "wb") as f:
             try:
                 while True:
@@ -113,49 +170,205 @@ class Proto:
                     if chunk_len == 0:
                         break
 
-                    data = self._recv_len(chunk_len)
-                    if data is None:
+                    if not self._recv_to_file(f, chunk_len, buf, sha1):
                         raise Exception(
                             "Remote peer disconnected while sending a file {filename!r}"
                         )
-
-                    f.write(data)
             except Exception:
                 self._close()
                 raise
         os.rename(filename + ".tmp", filename)
         logging.info(f"Received {filename!r}")
+        return sha1.hexdigest()
 
-    def send_file(self, filename: str) -> None:
+    def send_file(self, filename: str) -> Optional[source_hashes.KnownHash]:
+        """Send a file.  Return SHA-1 of its content along with the size and
+        mtime of the sent file, or None if the connection is closed."""
+        buf = memoryview(bytearray(FILE_CHUNK_SIZE))
+        sha1 = hashlib.sha1()
         with open(filename, "rb") as f:
+            st = os.fstat(f.fileno())
+            size = st.st_size
+            offset = 0
+            while offset < size:
+                chunk_len = min(FILE_CHUNK_SIZE, size - offset)
+                self.send(str(chunk_len))
+                if self._x is None:
+                    return None
+                # The chunk is read once more to hash it; it is in the page
+                # cache at this point, and the hash is not computed again from
+                # the file afterwards.
+                f.seek(offset)
+                n = f.readinto(buf[:chunk_len])
+                sha1.update(buf[:n])
+                if (
+                    n != chunk_len
+                    or self._send_file_chunk(f, offset, chunk_len) != chunk_len
+                ):
+                    # The file was truncated, the receiver would wait forever.
+                    self._close()
+                    raise Exception(f"File {filename!r} changed while sending")
+                offset += chunk_len
+            # The data is hashed and sent in separate reads, so a file changed
+            # in place in between would not match its hash.
+            st_after = os.fstat(f.fileno())
+            if (st_after.st_size, st_after.st_mtime_ns) != (size, st.st_mtime_ns):
+                self._close()
+                raise Exception(f"File {filename!r} changed while sending")
+            self.send("0")
+        return source_hashes.KnownHash(sha1.hexdigest(), size, st.st_mtime_ns)
+
+    def _send_file_chunk(self, f: BinaryIO, offset: int, count: int) -> int:
+        """Send a part of the file without framing.  Return the number of
+        bytes sent."""
+        assert self._x is not None
+        # Uses os.sendfile() where available, so the data is not copied into
+        # Python objects.
+        return self._x.sendfile(f, offset, count)
+
+    def _recv_to_file(
+        self, f: BinaryIO, length: int, buf: memoryview, sha1: "hashlib._Hash"
+    ) -> bool:
+        """Receive length bytes into the file and the hash, using buf as the
+        intermediate buffer.  Return False if the connection is closed."""
+        while length > 0:
+            chunk = buf[: min(length, len(buf))]
+            n = self._take_buf(chunk)
+            if n == 0:
+                if self._x is None:
+                    return False
+                n = self._recv_buf_into(chunk)
+                if n == 0:
+                    self._close()
+                    return False
+            f.write(chunk[:n])
+            sha1.update(chunk[:n])
+            length -= n
+        return True
+
+    def send_dir(self, dirname: str) -> Dict[str, str]:
+        """Send the files of the directory, compressing them on the fly.
+        Return SHA-1 of each sent file, by relative path.
+
+        For each file, a "file,RELPATH" line is followed by zlib-compressed
+        data in the same framing as in send_file().  The "end" line finishes
+        the transfer.
+        """
+        sent = {}
+        for folder, subfolders, filenames in os.walk(dirname):
+            subfolders.sort()
+            for filename in sorted(filenames):
+                path = os.path.join(folder, filename)
+                relpath = Path(os.path.relpath(path, dirname)).as_posix()
+                self.send(f"file,{relpath}")
+                with open(path, "rb") as f:
+                    sent[relpath] = self._send_compressed(f)
+        self.send("end")
+        return sent
+
+    def _send_compressed(self, f: BinaryIO) -> str:
+        compressor = zlib.compressobj()
+        sha1 = hashlib.sha1()
+        while True:
+            chunk = f.read(FILE_CHUNK_SIZE)
+            sha1.update(chunk)
+            if len(chunk) == 0:
+                data = compressor.flush()
+            else:
+                data = compressor.compress(chunk)
+            if len(data) != 0:
+                self.send(str(len(data)))
+                if not self._send_raw(data):
+                    return sha1.hexdigest()
+            if len(chunk) == 0:
+                break
+        self.send("0")
+        return sha1.hexdigest()
+
+    def recv_dir(self, dirname: Optional[str]) -> Dict[str, str]:
+        """Receive the files sent by send_dir() into dirname, or discard them
+        if it is None.  Return SHA-1 of each received file, by relative
+        path."""
+        received = {}
+        try:
             while True:
-                chunk = f.read(1024 * 1024)
-                self.send(str(len(chunk)))
-                if len(chunk) == 0:
-                    break
-                if self._x is not None:
-                    self._x.sendall(chunk)
-                else:
+                line = self.recv()
+                if line is None:
+                    raise Exception("Remote peer disconnected while sending files")
+                if line == "end":
                     break
+                if not line.startswith("file,"):
+                    raise ValueError(f"Expected 'file,...' or 'end', got {line!r}")
+                relpath = line[len("file,") :]
+                path = None if dirname is None else safe_join(dirname, relpath)
+                if path is None:
+                    if dirname is not None:
+                        raise ValueError(f"Unsafe file path {relpath!r}")
+                    with open(os.devnull, "wb") as f:
+                        self._recv_compressed(f)
+                    continue
+                os.makedirs(os.path.dirname(path), exist_ok=True)
+                with open(path + ".tmp", "wb") as f:
+                    sha1 = self._recv_compressed(f)
+                os.replace(path + ".tmp", path)
+                received[relpath] = sha1
+        except Exception:
+            # The rest of the stream can not be told apart from commands.
+            self._close()
+            raise
+        return received
+
+    def _recv_compressed(self, f: BinaryIO) -> str:
+        decompressor = zlib.decompressobj()
+        sha1 = hashlib.sha1()
+        while True:
+            line = self.recv()
+            if line is None:
+                raise Exception("Remote peer disconnected while sending a file")
+            chunk_len = int(line, 10)
+            if not 0 <= chunk_len <= MAX_COMPRESSED_CHUNK_SIZE:
+                raise ValueError(f"Invalid chunk length {chunk_len}")
+            if chunk_len == 0:
+                break
+            data = self._recv_len(chunk_len)
+            if data is None:
+                raise Exception("Remote peer disconnected while sending a file")
+            # Limit the output size to not hold a decompression bomb in memory.
+            out = decompressor.decompress(data, FILE_CHUNK_SIZE)
+            while len(out) != 0:
+                f.write(out)
+                sha1.update(out)
+                out = decompressor.decompress(
+                    decompressor.unconsumed_tail, FILE_CHUNK_SIZE
+                )
+        out = decompressor.flush()
+        f.write(out)
+        sha1.update(out)
+        if not decompressor.eof:
+            raise ValueError("Truncated compressed data")
+        return sha1.hexdigest()
+
+    def _send_raw(self, data: bytes) -> bool:
+        """Send data without framing.  Return False if the connection is
+        closed."""
+        if self._x is None:
+            return False
+        self._x.sendall(data)
+        return True
 
     def _recv_len(self, length: int) -> Optional[bytes]:
         if self._x is None:
             return None
-        result = b""
-        while length > 0:
-            if len(self._buf) > 0:
-                len2 = min(length, len(self._buf))
-                result += self._buf[:len2]
-                self._buf = self._buf[len2:]
-                length -= len2
-            else:
-                recvd = self._recv_buf(min(1024 * 16, length))
-                if len(recvd) == 0:
-                    self._close()
-                    return None
-                result += recvd
-                length -= len(recvd)
-        return result
+        result = bytearray(length)
+        view = memoryview(result)
+        pos = self._take_buf(view)
+        while pos < length:
+            n = self._recv_buf_into(view[pos:])
+            if n == 0:
+                self._close()
+                return None
+            pos += n
+        return bytes(result)
 
     def _close(self) -> None:
         if self._x is not None:
@@ -166,6 +379,16 @@ class Proto:
             finally:
                 self._x = None
 
+    def close(self) -> None:
+        """Close the connection.  Safe to call more than once."""
+        self._close()
+
+    def __enter__(self: _P) -> _P:
+        return self
+
+    def __exit__(self, *args: Any) -> None:
+        self.close()
+
     def enable_keepalive(self) -> None:
         after_idle_sec = 2
         interval_sec = 2
@@ -195,6 +418,141 @@ class Proto:
             )
 
 
+_T = TypeVar("_T")
+
+
+class StreamProto(Proto):
+    """Same protocol as Proto, implemented on top of asyncio streams.
+
+    Instead of calling select() before each recv() and concatenating bytes,
+    the buffering is done by asyncio.StreamReader.  The methods are blocking
+    as in Proto; each instance runs its own event loop, so it could be used
+    from any thread.
+    """
+
+    # Size of the read buffer.  Longer lines are read in parts.  A large
+    # buffer slows down the reading, as each read moves the rest of the buffer.
+    LIMIT = 256 * 1024
+
+    def __init__(self, conn: socket.socket) -> None:
+        super().__init__(conn)
+        self._loop: Optional[asyncio.AbstractEventLoop] = asyncio.new_event_loop()
+        try:
+            self._reader, self._writer = self._run(
+                asyncio.open_connection(sock=conn, limit=self.LIMIT)
+            )
+        except BaseException:
+            # The caller never gets the instance, so nobody else would close
+            # the loop.  The socket stays with the caller.
+            self._loop.close()
+            self._loop = None
+            self._x = None
+            raise
+        # Make drain() wait until everything is sent, as socket.sendall() does.
+        # Otherwise the rest would be sent only when the loop runs next time.
+        self._writer.transport.set_write_buffer_limits(0)
+
+    def _run(self, coro: Coroutine[Any, Any, _T]) -> _T:
+        assert self._loop is not None
+        return self._loop.run_until_complete(coro)
+
+    def recv(self) -> Optional[str]:
+        if self._x is None:
+            return None
+
+        async def readline() -> bytes:
+            parts = []
+            while True:
+                try:
+                    parts.append(await self._reader.readuntil(b"\n"))
+                    return b"".join(parts)
+                except asyncio.LimitOverrunError as e:
+                    parts.append(await self._reader.readexactly(e.consumed))
+
+        try:
+            line = self._run(readline())
+        except (asyncio.IncompleteReadError, OSError):
+            self._close()
+            return None
+        return line[:-1].rstrip(b"\r").decode(errors="replace")
+
+    def send(self, data: str) -> None:
+        if self._x is None:
+            return
+        try:
+            self._send_raw(data.encode() + b"\r\n")
+        except OSError:
+            logging.exception("Got an exception while sending a message to socket")
+            self._close()
+
+    def _send_raw(self, data: bytes) -> bool:
+        if self._x is None:
+            return False
+        self._writer.write(data)
+        if self._writer.transport.get_write_buffer_size() != 0:
+            self._run(self._writer.drain())
+        return True
+
+    def _recv_len(self, length: int) -> Optional[bytes]:
+        if self._x is None:
+            return None
+        try:
+            return self._run(self._reader.readexactly(length))
+        except (asyncio.IncompleteReadError, OSError):
+            self._close()
+            return None
+
+    def _send_file_chunk(self, f: BinaryIO, offset: int, count: int) -> int:
+        assert self._loop is not None
+        return self._run(
+            self._loop.sendfile(self._writer.transport, f, offset, count)
+        )
+
+    def _recv_to_file(
+        self, f: BinaryIO, length: int, buf: memoryview, sha1: "hashlib._Hash"
+    ) -> bool:
+        if self._x is None:
+            return False
+
+        async def recv() -> bool:
+            remaining = length
+            while remaining > 0:
+                data = await self._reader.read(min(remaining, len(buf)))
+                if len(data) == 0:
+                    return False
+                f.write(data)
+                sha1.update(data)
+                remaining -= len(data)
+            return True
+
+        try:
+            if self._run(recv()):
+                return True
+        except OSError:
+            pass
+        self._close()
+        return False
+
+    def _close(self) -> None:
+        try:
+            if self._x is not None:
+                self._x = None
+                self._writer.close()
+                self._run(self._writer.wait_closed())
+        except Exception:
+            logging.exception("Got an exception while closing a socket")
+        finally:
+            if self._loop is not None:
+                self._loop.close()
+                self._loop = None
+
+
+TRANSPORTS: Dict[str, Type[Proto]] = {
+    "select": Proto,
+    "asyncio": StreamProto,
+}
+
+
 class SignalHandler:
     # See also:
     #   https://vorpus.org/blog/control-c-handling-in-python-and-trio/
@@ -247,15 +605,25 @@ def run_server(
     host: str,
     port: int,
     handle: Callable[[Proto], None],
+    threaded: bool = False,
+    proto: Type[Proto] = Proto,
 ) -> None:
     class Handler(socketserver.BaseRequestHandler):
         def handle(self) -> None:
             logging.info(f"Connected {self.client_address}")
-            p = Proto(self.request)
+            p = proto(self.request)
             try:
                 handle(p)
+            except SystemExit:
+                # Raised by a handler only to stop the server, e.g. on a
+                # client's request.  In the threaded mode, the exception would
+                # only end the current thread.
+                stop()
+                raise
             except Exception:
                 logging.exception("Got an exception")
+            finally:
+                p.close()
             logging.info("Done processing")
 
     class Server(socketserver.TCPServer):
@@ -272,13 +640,19 @@ def run_server(
         # same as default poll_interval in server_forever()
         timeout = 0.5
 
+    class ThreadingServer(socketserver.ThreadingMixIn, Server):
+        # The connections that are still open when the server stops are
+        # dropped by the caller.
+        daemon_threads = True
+
     done = False
 
     def stop() -> None:
         nonlocal done
         done = True
 
-    with Server((host, port), Handler) as server:
+    server_class = ThreadingServer if threaded else Server
+    with server_class((host, port), Handler) as server:
         logging.info(f"Ready to accept connections at {host}:{port}")
         sig.on_stop = stop
         while not done:
@@ -291,26 +665,58 @@ def check_label(label: str) -> bool:
 
 
 class BufferHandler(logging.Handler):
+    """Collects the log records of a thread to save them into a file later.
+
+    Each thread has its own buffer, so concurrent server connections do not
+    mix their logs.  The records of the threads that never called `start()`,
+    e.g. the Tee thread or the workers of `source_hashes.hash_dir()`, can not
+    be attributed, so they go to all the buffers.
+    """
+
     def __init__(self) -> None:
         logging.Handler.__init__(self)
-        self._records: Optional[List[logging.LogRecord]] = None
-
-    def start(self) -> None:
-        self._records = []
+        self._records: Dict[int, List[logging.LogRecord]] = {}
 
-    def stop(self, fname: Optional[str] = None) -> None:
+    def start(self, parent: Optional[int] = None) -> None:
+        """Start collecting the records of the current thread, into the buffer
+        of the parent thread if given, e.g. for a worker of that thread.  Nothing
+        is collected if the parent thread does not collect its records."""
+        self.acquire()
+        try:
+            records = [] if parent is None else self._records.get(parent)
+            if records is not None:
+                self._records[threading.get_ident()] = records
+        finally:
+            self.release()
+
+    def stop(self, fname: Optional[str] = None, thread: Optional[int] = None) -> None:
+        """Stop collecting the records of the given thread (the current one by
+        default) and save them into fname."""
+        if thread is None:
+            thread = threading.get_ident()
+        self.acquire()
+        try:
+            records = self._records.pop(thread, None)
+        finally:
+            self.release()
         if fname is None:
-            self._records = None
             return
-        assert self._records is not None
-        records, self._records = self._records, None
+        assert records is not None
         with open(fname, "w", newline="\n") as f:
             for record in records:
                 f.write("%s\n" % self.format(record))
 
     def emit(self, record: logging.LogRecord) -> None:
-        if self._records is not None:
-            self._records.append(record)
+        # Called with the handler lock held.
+        records = self._records.get(record.thread or 0)
+        if records is not None:
+            records.append(record)
+            return
+        seen: Set[int] = set()
+        for records in self._records.values():
+            if id(records) not in seen:
+                seen.add(id(records))
+                records.append(record)
 
 
 log_redirect = BufferHandler()
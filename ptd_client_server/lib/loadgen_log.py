@@ -0,0 +1,104 @@
+# Copyright 2018 The MLPerf Authors. All Rights Reserved.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+# =============================================================================
+
+"""Extraction of the power_begin and power_end times from the loadgen detail
+log (`mlperf_log_detail.txt`), which loadgen writes as records like:
+
+    :::MLLOG {"key": "power_begin", "value": "01-22-2021 15:05:14.313", ...}
+
+The log can be gigabytes long, but only these two records are needed:
+power_begin is logged near the beginning of the run and power_end near the
+end.  So the file is memory-mapped and searched for the keys with
+`mmap.find()` from the head and `mmap.rfind()` from the tail, and only the
+matching lines are decoded.
+"""
+
+from datetime import datetime, timezone
+from typing import Any, Optional, Tuple
+import json
+import mmap
+import os
+import re
+
+MLLOG_PREFIX = ":::MLLOG "
+RE_TIME = re.compile(r"(\d*-\d*-\d* \d*:\d*:\d*\.\d*)")
+
+
+def parse_record(line: str, key: str) -> Optional[str]:
+    """Return the value of the record of the key, or None if the line is a
+    record of another key.  For a line that is not a valid record, return the
+    first time stamp in it."""
+    if line.startswith(MLLOG_PREFIX):
+        try:
+            record: Any = json.loads(line[len(MLLOG_PREFIX) :])
+        except ValueError:
+            pass
+        else:
+            if not isinstance(record, dict) or record.get("key") != key:
+                return None
+            value = record.get("value")
+            return value if isinstance(value, str) else None
+    m = RE_TIME.search(line)
+    return m.group(0) if m else None
+
+
+def parse_time(value: str, timezone_offset: int) -> Optional[float]:
+    try:
+        log_datetime = datetime.strptime(value, "%m-%d-%Y %H:%M:%S.%f")
+    except ValueError:
+        return None
+    return log_datetime.replace(tzinfo=timezone.utc).timestamp() + timezone_offset
+
+
+def _find_time(
+    data: "mmap.mmap", key: str, timezone_offset: int, from_tail: bool
+) -> Optional[float]:
+    """Search for the first (or the last, if from_tail) line mentioning the key
+    that has a valid time."""
+    needle = key.encode()
+    pos = len(data) if from_tail else 0
+    while True:
+        if from_tail:
+            found = data.rfind(needle, 0, pos)
+        else:
+            found = data.find(needle, pos)
+        if found == -1:
+            return None
+        start = data.rfind(b"\n", 0, found) + 1
+        end = data.find(b"\n", found)
+        if end == -1:
+            end = len(data)
+        line = data[start:end].decode(errors="replace").strip()
+        value = parse_record(line, key)
+        if value is not None:
+            result = parse_time(value, timezone_offset)
+            if result is not None:
+                return result
+        pos = start if from_tail else end
+
+
+def power_times(
+    fname: str, timezone_offset: int
+) -> Tuple[Optional[float], Optional[float]]:
+    """Return the power_begin and power_end times from the loadgen detail log
+    as UNIX timestamps, or None for a missing one."""
+    with open(fname, "rb") as f:
+        if os.fstat(f.fileno()).st_size == 0:
+            return None, None  # mmap can't map an empty file
+        with mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ) as data:
+            return (
+                _find_time(data, "power_begin", timezone_offset, from_tail=False),
+                _find_time(data, "power_end", timezone_offset, from_tail=True),
+            )
@@ -0,0 +1,555 @@
+# Copyright 2018 The MLPerf Authors. All Rights Reserved.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+# =============================================================================
+
+"""Parser of the power samples logged by PTDaemon, one per line:
+
+    Time,MM-DD-YYYY HH:MM:SS.mmm,Watts,W,Volts,V,Amps,A,PF,PF,Mark,MARK
+
+followed by a `,ChN,Watts,W,Volts,V,Amps,A,PF,PF` group per channel for
+multichannel analyzers.
+
+`decode()` converts a whole buffer of lines into columns: the lines with the
+same set of columns are joined and split at once, and each column is taken as
+a slice of the resulting list, so there is no per-field Python code except
+for the time stamps.
+
+`encode()` and `ColumnFile` write and memory-map a binary copy of the columns,
+which the server saves as `spl.bin` next to each `spl.txt`.
+"""
+
+from array import array
+from itertools import repeat
+from typing import Any, Dict, Iterator, List, NamedTuple, Optional, Sequence, Tuple
+import dataclasses
+import datetime
+import functools
+import itertools
+import json
+import math
+import mmap
+import operator
+import os
+import re
+import struct
+import sys
+
+
+RE_SAMPLE = re.compile(
+    r"""^
+        Time,  [^,]*,
+        Watts, [^,]*,
+        Volts, (?P<v> [^,]* ),
+        Amps,  (?P<a> [^,]* ),
+        PF, [^,]*,
+        Mark,  (?P<mark> [^,]* )
+    """,
+    re.X,
+)
+
+# Same as RE_SAMPLE, but applied to a whole block of the log file at once.
+RE_SAMPLE_BYTES = re.compile(
+    rb"""^
+        Time,  [^,\n]*,
+        Watts, [^,\n]*,
+        Volts, [^,\n]*,
+        Amps,  [^,\n]*,
+        PF,    [^,\n]*,
+        Mark,  (?P<mark> [^,\r\n]* )
+    """,
+    re.X | re.M,
+)
+
+# A whole sample line, without the line terminator and trailing spaces.
+_RE_SAMPLE_LINE = re.compile(
+    r"""^
+        ( Time,  [^,\n]*,
+          Watts, [^,\n]*,
+          Volts, [^,\n]*,
+          Amps,  [^,\n]*,
+          PF,    [^,\n]*,
+          Mark,  [^,\r\n]* (?: ,[^\r\n]*? )? )
+        [ \t\r]* $
+    """,
+    re.X | re.M,
+)
+
+_RE_TIME = re.compile(
+    r"(?P<minute> \d\d-\d\d-\d{4} [ ] \d\d:\d\d ) : (?P<seconds> \d\d )"
+    r"(?: \. (?P<fraction> \d{1,9} ) )? $",
+    re.X,
+)
+
+# Number of words before the first channel group, and in each group.
+TOTAL_WIDTH = 12
+CHANNEL_WIDTH = 9
+
+_TOTAL_NAMES = ["Time", "Watts", "Volts", "Amps", "PF", "Mark"]
+_CHANNEL_NAMES = ["Watts", "Volts", "Amps", "PF"]
+
+_EPOCH = datetime.date(1970, 1, 1).toordinal()
+
+
+class LitNotFoundError(Exception):
+    pass
+
+
+class ExtraChannelError(Exception):
+    pass
+
+
+def _check_names(words: Sequence[str], start: int, names: List[str]) -> None:
+    for i, name in enumerate(names):
+        if words[start + 2 * i] != name:
+            raise LitNotFoundError(f"Expected {name!r}, got {words[start + 2 * i]!r}")
+
+
+def split(line: str) -> List[str]:
+    """Split a sample line into words, checking the column names."""
+    words = line.rstrip().split(",")
+    if words[0:TOTAL_WIDTH:2] != _TOTAL_NAMES:
+        _check_names(words, 0, _TOTAL_NAMES)
+    for i in channel_groups(len(words)):
+        if words[i + 1 : i + CHANNEL_WIDTH : 2] != _CHANNEL_NAMES:
+            _check_names(words, i + 1, _CHANNEL_NAMES)
+    return words
+
+
+def channel_groups(width: int) -> range:
+    """Return the index of the `ChN` word of each channel group in a line of
+    `width` words."""
+    if width < TOTAL_WIDTH or (width - TOTAL_WIDTH) % CHANNEL_WIDTH > 1:
+        # A trailing comma is tolerated, anything else is not a sample.
+        raise LitNotFoundError(f"Unexpected number of columns: {width}")
+    return range(TOTAL_WIDTH, width - 1, CHANNEL_WIDTH)
+
+
+def channel(word: str) -> int:
+    """Parse the `ChN` word."""
+    if not word.startswith("Ch") or not word[2:].isdigit():
+        raise LitNotFoundError(f"Expected a channel, got {word!r}")
+    return int(word[2:])
+
+
+_TIME_FORMAT = "MM-DD-YYYY HH:MM:SS.mmm"
+
+
+def parse_time(value: str) -> int:
+    """Parse the `Time` field into nanoseconds since the epoch.  PTDaemon is
+    run with TZ=UTC."""
+    m = _RE_TIME.match(value)
+    if m is None:
+        raise ValueError(f"Expected {_TIME_FORMAT!r}, got {value!r}")
+    seconds, fraction = m["seconds"], m["fraction"]
+    if int(seconds) > 59:
+        raise ValueError(f"Expected {_TIME_FORMAT!r}, got {value!r}")
+    result = _minute_ns(m["minute"]) + int(seconds) * 10 ** 9
+    if fraction is not None:
+        result += int(fraction.ljust(9, "0"))
+    return result
+
+
+@functools.lru_cache(maxsize=256)
+def _minute_ns(value: str) -> int:
+    """Parse `MM-DD-YYYY HH:MM` into nanoseconds since the epoch."""
+    month, day, year = int(value[0:2]), int(value[3:5]), int(value[6:10])
+    hours, minutes = int(value[11:13]), int(value[14:16])
+    if hours > 23 or minutes > 59:
+        raise ValueError(f"Expected {_TIME_FORMAT!r}, got {value!r}")
+    days = datetime.date(year, month, day).toordinal() - _EPOCH
+    return ((days * 24 + hours) * 60 + minutes) * 60 * 10 ** 9
+
+
+def parse_times(values: List[str]) -> "array[int]":
+    """Same as `parse_time()` for each value, but faster for a long list of
+    values of the same length."""
+    n = len(values)
+    if n == 0:
+        return array("q")
+    length = len(values[0])
+    digits = length - len("MM-DD-YYYY HH:MM:SS.")
+    if digits not in range(1, 10) or any(len(v) != length for v in values):
+        return array("q", map(parse_time, values))
+
+    # The samples are taken about once a second, so the minutes are parsed
+    # once per distinct value, and only the seconds are parsed per sample.
+    text = "".join(values)
+    seconds = [v[17:19] + v[20:] for v in values]
+    if (
+        text[16::length] != ":" * n
+        or text[19::length] != "." * n
+        or max(text[17::length]) > "5"
+        or not "".join(seconds).isdigit()
+    ):
+        return array("q", map(parse_time, values))
+    minutes = [v[:16] for v in values]
+    minutes_ns = {m: _minute_ns(m) for m in dict.fromkeys(minutes)}
+    return array(
+        "q",
+        map(
+            operator.add,
+            map(minutes_ns.__getitem__, minutes),
+            map(operator.mul, map(int, seconds), repeat(10 ** (9 - digits))),
+        ),
+    )
+
+
+class Block(NamedTuple):
+    """Consecutive sample lines with the same columns.  The word `col` of the
+    row `i` is `words[i * width + col]`, so a column is `words[col::width]`."""
+
+    words: List[str]
+    width: int
+    rows: int
+    channels: Tuple[int, ...]
+
+    def column(self, col: int) -> List[str]:
+        return self.words[col :: self.width]
+
+
+def tokenize(data: str, strict: bool = True) -> Iterator[Block]:
+    """Split the sample lines of `data` into blocks, skipping other lines.
+
+    A line that looks like a sample (matches `RE_SAMPLE`) but has unexpected
+    column names raises `LitNotFoundError`, or is skipped if not `strict`.
+    """
+    lines = [line for line in data.splitlines() if line.startswith("Time,")]
+    if len(lines) == 0:
+        return
+    widths = [line.count(",") for line in lines]
+    if min(widths) == max(widths):
+        runs: Iterator[List[str]] = iter([lines])
+    else:
+        runs = (
+            [line for _, line in run]
+            for _, run in itertools.groupby(zip(widths, lines), lambda x: x[0])
+        )
+    for run in runs:
+        block = _tokenize_run(run)
+        if block is not None:
+            yield block
+        else:
+            yield from _tokenize_lines(run, strict)
+
+
+def _tokenize_run(lines: List[str]) -> Optional[Block]:
+    """Tokenize lines having the same number of words.  Return None unless
+    all of them are valid samples with the same channels."""
+    words = ",".join(lines).split(",")
+    width = len(words) // len(lines)
+    rows = len(lines)
+    try:
+        groups = channel_groups(width)
+    except LitNotFoundError:
+        return None
+    for i, name in enumerate(_TOTAL_NAMES):
+        if words[2 * i :: width].count(name) != rows:
+            return None
+    channels = []
+    for g in groups:
+        for i, name in enumerate(_CHANNEL_NAMES):
+            if words[g + 1 + 2 * i :: width].count(name) != rows:
+                return None
+        if words[g::width].count(words[g]) != rows:
+            return None
+        try:
+            channels.append(channel(words[g]))
+        except LitNotFoundError:
+            return None
+    return Block(words, width, rows, tuple(channels))
+
+
+def _tokenize_lines(lines: List[str], strict: bool) -> Iterator[Block]:
+    """Slow path of `tokenize()`: check the lines one by one, and split the
+    valid ones by the channel sets."""
+    good = []
+    for line in lines:
+        if RE_SAMPLE.match(line) is None:
+            continue
+        try:
+            words = split(line)
+            layout = tuple(channel(words[i]) for i in channel_groups(len(words)))
+        except LitNotFoundError:
+            if strict:
+                raise
+            continue
+        good.append(((len(words), layout), words))
+    for (width, layout), run in itertools.groupby(good, lambda x: x[0]):
+        words = [word for _, line_words in run for word in line_words]
+        yield Block(words, width, len(words) // width, layout)
+
+
+# The numeric fields of the total and of each channel, and the offsets of their
+# values from the `Watts` value.
+FIELDS = ("watts", "volts", "amps", "pf")
+_FIELD_OFFSETS = {"watts": 0, "volts": 2, "amps": 4, "pf": 6}
+
+
+@dataclasses.dataclass
+class Columns:
+    """Values of one channel; NaN where the channel is missing in a line.
+    The fields not requested by `decode()` are left empty."""
+
+    # Number of lines having this channel.
+    count: int = 0
+    watts: "array[float]" = dataclasses.field(default_factory=lambda: array("d"))
+    volts: "array[float]" = dataclasses.field(default_factory=lambda: array("d"))
+    amps: "array[float]" = dataclasses.field(default_factory=lambda: array("d"))
+    pf: "array[float]" = dataclasses.field(default_factory=lambda: array("d"))
+    # The original text of volts and amps, if requested by `decode()`.
+    volts_text: Optional[List[str]] = None
+    amps_text: Optional[List[str]] = None
+
+
+@dataclasses.dataclass
+class Samples:
+    """Sample lines decoded into columns."""
+
+    fields: Sequence[str] = FIELDS
+    keep_text: bool = False
+    rows: int = 0
+    # Empty if the time stamps are not requested by `decode()`.
+    time_ns: "array[int]" = dataclasses.field(default_factory=lambda: array("q"))
+    # Index into `marks`.
+    mark: "array[int]" = dataclasses.field(default_factory=lambda: array("i"))
+    marks: List[str] = dataclasses.field(default_factory=list)
+    # 0 is the total (the fields before `Mark`), N is the `ChN` group.
+    channels: Dict[int, Columns] = dataclasses.field(default_factory=dict)
+
+    def add(self, block: Block, times: bool = True) -> None:
+        width = block.width
+        if times:
+            self.time_ns.extend(parse_times(block.column(1)))
+
+        mark_column = block.column(11)
+        index = {name: i for i, name in enumerate(self.marks)}
+        for name in dict.fromkeys(mark_column):
+            if name not in index:
+                index[name] = len(self.marks)
+                self.marks.append(name)
+        self.mark.extend(map(index.__getitem__, mark_column))
+
+        groups = [(0, 3)]
+        groups += ((ch, i + 2) for ch, i in zip(block.channels, channel_groups(width)))
+        for ch, col in groups:
+            if ch not in self.channels:
+                self.channels[ch] = self._new_columns()
+            c = self.channels[ch]
+            c.count += block.rows
+            for name in self.fields:
+                words = block.words[col + _FIELD_OFFSETS[name] :: width]
+                getattr(c, name).extend(map(float, words))
+                if self.keep_text and name in ("volts", "amps"):
+                    getattr(c, name + "_text").extend(words)
+
+        self.rows += block.rows
+        for c in self.channels.values():
+            self._pad(c)
+
+    def _new_columns(self) -> Columns:
+        c = Columns()
+        if self.keep_text:
+            c.volts_text, c.amps_text = [], []
+        self._pad(c)
+        return c
+
+    def _pad(self, c: Columns) -> None:
+        for name in self.fields:
+            column: "array[float]" = getattr(c, name)
+            missing = self.rows - len(column)
+            if missing > 0:
+                column.extend(array("d", [math.nan]) * missing)
+                if self.keep_text and name in ("volts", "amps"):
+                    getattr(c, name + "_text").extend(["nan"] * missing)
+
+    def max_volts_amps(
+        self, start_channel: int, amount_of_channels: int
+    ) -> Tuple[str, str]:
+        """Return the text of max volts and amps among the total and the
+        channels `start_channel` to `start_channel + amount_of_channels - 1`.
+        Requires `keep_text` and `check_channels()`.  Returns ("-1", "-1") if
+        there are no rows."""
+        end_channel = start_channel + amount_of_channels
+        result = []
+        for name in ("volts", "amps"):
+            best, best_text = -1.0, "-1"
+            for ch, c in self.channels.items():
+                if ch != 0 and not start_channel <= ch < end_channel:
+                    continue
+                values: "array[float]" = getattr(c, name)
+                texts: Optional[List[str]] = getattr(c, name + "_text")
+                assert texts is not None
+                m = max(values, default=-1.0)
+                if m > best:
+                    best, best_text = m, texts[values.index(m)]
+            result.append(best_text)
+        return result[0], result[1]
+
+    def check_channels(self, start_channel: int, amount_of_channels: int) -> None:
+        """Raise ExtraChannelError unless each line has all the channels
+        `start_channel` to `start_channel + amount_of_channels - 1`, and no
+        channels after them."""
+        end_channel = start_channel + amount_of_channels
+        for ch in range(start_channel, end_channel):
+            c = self.channels.get(ch)
+            if self.rows and (c is None or c.count != self.rows):
+                raise ExtraChannelError("There are extra ptd channels in configuration")
+        for ch in self.channels:
+            if ch >= end_channel and ch != 0:
+                raise ExtraChannelError("There are extra ptd channels in the log")
+
+
+def decode(
+    data: str,
+    strict: bool = True,
+    keep_text: bool = False,
+    fields: Sequence[str] = FIELDS,
+    times: bool = True,
+) -> Samples:
+    """Decode the sample lines of `data` into columns, skipping other lines.
+    See `tokenize()` for the meaning of `strict`.
+
+    Only the given `fields` are converted, and the time stamps if `times`.
+    `keep_text` also keeps the original text of volts and amps, see
+    `Samples.max_volts_amps()`.
+    """
+    result = Samples(fields, keep_text)
+    for block in tokenize(data, strict):
+        result.add(block, times)
+    return result
+
+
+# Columnar binary copy of the sample lines (`spl.bin` next to `spl.txt`):
+#   magic, uint32 header length, JSON header, columns.
+# Each column starts at a multiple of 8 bytes and is an array of little-endian
+# values of the type given in the header: "q" (int64) for `time_ns`, "i"
+# (int32) for `mark`, "d" (float64) for the fields of each channel.
+COLUMNS_MAGIC = b"PTDCOLS\x00"
+COLUMNS_VERSION = 1
+_COLUMNS_ALIGN = 8
+
+
+def encode(samples: Samples) -> bytes:
+    """Return the columnar binary representation of `samples`, decoded with
+    all the fields and the time stamps."""
+    if tuple(samples.fields) != FIELDS or len(samples.time_ns) != samples.rows:
+        raise ValueError("All the fields and the time stamps are required")
+
+    arrays: List[Tuple[Dict[str, Any], "array[Any]"]] = [
+        ({"name": "time_ns"}, samples.time_ns),
+        ({"name": "mark"}, samples.mark),
+    ]
+    for ch in sorted(samples.channels):
+        c = samples.channels[ch]
+        arrays += (({"name": name, "channel": ch}, getattr(c, name)) for name in FIELDS)
+
+    # The offsets depend on the header length, which depends on the offsets.
+    # Reserve enough digits for them first.
+    header: Dict[str, Any] = {
+        "version": COLUMNS_VERSION,
+        "rows": samples.rows,
+        "marks": samples.marks,
+        "columns": [dict(d, type=a.typecode, offset=0) for d, a in arrays],
+    }
+    header_len = len(json.dumps(header)) + 20 * len(arrays)
+    offset = _align(len(COLUMNS_MAGIC) + 4 + header_len)
+    for column, (_, a) in zip(header["columns"], arrays):
+        column["offset"] = offset
+        offset = _align(offset + len(a) * a.itemsize)
+    header_bytes = json.dumps(header).encode().ljust(header_len)
+
+    result = bytearray(COLUMNS_MAGIC)
+    result += struct.pack("<I", len(header_bytes))
+    result += header_bytes
+    for column, (_, a) in zip(header["columns"], arrays):
+        result += bytes(column["offset"] - len(result))
+        if sys.byteorder == "big":
+            a = array(a.typecode, a)
+            a.byteswap()
+        result += a.tobytes()
+    return bytes(result)
+
+
+def _align(offset: int) -> int:
+    return (offset + _COLUMNS_ALIGN - 1) // _COLUMNS_ALIGN * _COLUMNS_ALIGN
+
+
+class ColumnFile:
+    """Reader of the files written from `encode()`.  The columns are views
+    into the memory-mapped file, so they are not copied or parsed.
+
+        with ptd_log.ColumnFile("spl.bin") as f:
+            watts = f.column("watts", 0)
+
+    The views should not be used after the file is closed.
+    """
+
+    def __init__(self, fname: str) -> None:
+        with open(fname, "rb") as f:
+            size = os.fstat(f.fileno()).st_size
+            if size < len(COLUMNS_MAGIC) + 4:
+                raise ValueError(f"{fname!r} is not a columnar sample file")
+            self._mmap = mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ)
+        self._views: List[memoryview] = []
+        try:
+            if self._mmap[: len(COLUMNS_MAGIC)] != COLUMNS_MAGIC:
+                raise ValueError(f"{fname!r} is not a columnar sample file")
+            pos = len(COLUMNS_MAGIC)
+            (header_len,) = struct.unpack_from("<I", self._mmap, pos)
+            header = json.loads(self._mmap[pos + 4 : pos + 4 + header_len])
+            if header["version"] != COLUMNS_VERSION:
+                raise ValueError(f"Unsupported version {header['version']!r}")
+            self.rows: int = header["rows"]
+            self.marks: List[str] = header["marks"]
+            self._columns: Dict[Tuple[str, Optional[int]], Dict[str, Any]] = {
+                (c["name"], c.get("channel")): c for c in header["columns"]
+            }
+            for c in self._columns.values():
+                itemsize = array(c["type"]).itemsize
+                if c["offset"] + self.rows * itemsize > size:
+                    raise ValueError(f"{fname!r} is truncated")
+        except Exception:
+            self._mmap.close()
+            raise
+
+    @property
+    def channels(self) -> List[int]:
+        return sorted({ch for _, ch in self._columns if ch is not None})
+
+    def column(self, name: str, channel: Optional[int] = None) -> Sequence[Any]:
+        """Return `time_ns`, `mark` (index into `marks`), or a field of the
+        given channel (0 is the total)."""
+        c = self._columns[name, channel]
+        itemsize = array(c["type"]).itemsize
+        raw = memoryview(self._mmap)[c["offset"] : c["offset"] + self.rows * itemsize]
+        self._views.append(raw)
+        if sys.byteorder == "big":
+            a = array(c["type"], raw.tobytes())
+            a.byteswap()
+            return a
+        view = raw.cast(c["type"])
+        self._views.append(view)
+        return view
+
+    def close(self) -> None:
+        for view in reversed(self._views):
+            view.release()
+        self._views = []
+        self._mmap.close()
+
+    def __enter__(self) -> "ColumnFile":
+        return self
+
+    def __exit__(self, exc_type: Any, exc_value: Any, traceback: Any) -> None:
+        self.close()
@@ -14,19 +14,37 @@
 # =============================================================================
 
 from __future__ import annotations
-from decimal import Decimal
 from enum import Enum
 from ipaddress import ip_address
 from pathlib import Path
-from typing import Any, Callable, Optional, Dict, Tuple, List, Set, NoReturn
+from typing import (
+    Any,
+    BinaryIO,
+    Callable,
+    Dict,
+    Iterable,
+    Iterator,
+    List,
+    NoReturn,
+    Optional,
+    Pattern,
+    Set,
+    TextIO,
+    Tuple,
+)
 import argparse
 import atexit
-import builtins
 import configparser
+import copy
+import dataclasses
 import datetime
+import functools
+import hashlib
 import logging
+import math
 import os
 import re
+import select
 import shutil
 import socket
 import subprocess
@@ -37,27 +55,51 @@ import uuid
 import zipfile
 
 from ptd_client_server.lib import common
+from ptd_client_server.lib import ptd_log
+from ptd_client_server.lib import source_hashes
 from ptd_client_server.lib import summary as summarylib
 from ptd_client_server.lib import time_sync
 
 
-RE_PTD_LOG = re.compile(
-    r"""^
-        Time,  [^,]*,
-        Watts, [^,]*,
-        Volts, (?P<v> [^,]* ),
-        Amps,  (?P<a> [^,]* ),
-        PF, [^,]*,
-        Mark,  (?P<mark> [^,]* )
-    """,
-    re.X,
-)
+RE_PTD_LOG = ptd_log.RE_SAMPLE
+RE_PTD_LOG_BYTES = ptd_log.RE_SAMPLE_BYTES
+
+LOG_INDEX_BLOCK_SIZE = 16 * 1024 * 1024
+
+
+@functools.lru_cache(maxsize=16)
+def _re_other_mark(mark: bytes) -> Pattern[bytes]:
+    """Find a mark field other than the given one."""
+    return re.compile(rb",Mark,(?!" + re.escape(mark) + rb"[,\r\n])")
 
+
+# The time to let the analyzer settle after setting the ranges, before Go, and
+# to keep measuring after the load.  See Session._settle_start().
 ANALYZER_SLEEP_SECONDS: float = 10
+# How much longer to wait before Go if the analyzer has not reported the new
+# ranges after ANALYZER_SLEEP_SECONDS.
+ANALYZER_RANGES_TIMEOUT_SECONDS: float = 10
+# The interval of polling the ranges with RR.
+SETTLE_POLL_SECONDS = 0.25
+
+# Linux PTDaemon connected to WT333E over USB takes 17 seconds to fire up.
+# We wait for 30 seconds to be sure.
+PTD_START_TIMEOUT_SECONDS = 30
+# After each piece of PTDaemon output, connecting is retried starting with the
+# shorter delay, doubled up to the longer one while PTDaemon stays silent.
+PTD_CONNECT_RETRY_SECONDS = (0.01, 0.5)
+# The lines of the PTDaemon startup output replayed into ptd_logs.txt of the
+# later sessions with keepRunning.  The compliance checker expects the
+# uncertainty line before the ranging; the startup errors and the rest of the
+# output belong to the session that started PTDaemon.
+RE_PTD_BANNER_LINE = re.compile(rb"Uncertainty checking for ")
+PTD_BANNER_BEGIN = b"# Replayed from the startup of the running PTDaemon:\n"
+PTD_BANNER_END = b"# End of the replayed output\n"
 _debug = os.getenv("MLPP_DEBUG") is not None
 
 if _debug:
     ANALYZER_SLEEP_SECONDS = 0.5
+    ANALYZER_RANGES_TIMEOUT_SECONDS = 0.5
 
 # https://github.com/mlcommons/power-dev/issues/154#issuecomment-785188217
 MULTICHANNEL_DEVICES = [48, 59, 61, 77]
@@ -84,112 +126,107 @@ class MaxVoltsAmpsNegativeValuesError(Exception):
     pass
 
 
-class LitNotFoundError(Exception):
-    pass
+class PtdError(Exception):
+    """PTDaemon has failed or stopped replying.  Ends the connection whose
+    session uses it, the other connections go on."""
 
 
-class ExtraChannelError(Exception):
-    pass
+LitNotFoundError = ptd_log.LitNotFoundError
+ExtraChannelError = ptd_log.ExtraChannelError
 
 
-class Parser:
-    def __init__(self, row: str):
-        self.words = row.rstrip().split(",")
-        self._cur_number = 0
-        self.word_len = len(self.words)
+def max_volts_amps(
+    log_fname: str, mark: str, start_channel: int, amount_of_channels: int
+) -> Tuple[str, str]:
+    with open(log_fname, "r") as f:
+        return max_volts_amps_lines(f, mark, start_channel, amount_of_channels)
 
-    def skip(self) -> None:
-        self.str()
 
-    def lit(self, column_name: str) -> None:
-        if self.words[self._cur_number] == column_name:
-            self.skip()
-            return
-        raise LitNotFoundError(
-            f"Expected {column_name!r}, got {self.words[self._cur_number]!r}"
-        )
+def max_volts_amps_lines(
+    lines: Iterable[str], mark: str, start_channel: int, amount_of_channels: int
+) -> Tuple[str, str]:
+    selected = [line.rstrip("\r\n") for line in lines if _has_mark(line, mark)]
+    maxVolts, maxAmps = _max_volts_amps(
+        "\n".join(selected), start_channel, amount_of_channels
+    )
+    if float(maxVolts) <= 0 or float(maxAmps) <= 0:
+        raise MaxVoltsAmpsNegativeValuesError(f"Could not find values for {mark!r}")
+    return maxVolts, maxAmps
 
-    def check(self, column_name: str) -> bool:
-        return self.words[self._cur_number] == column_name
 
-    def decimal(self) -> Any:
-        return self._next(Decimal, "Decimal")
+def _has_mark(line: str, mark: str) -> bool:
+    m = RE_PTD_LOG.match(line.rstrip("\r\n"))
+    return m is not None and m["mark"] == mark
 
-    def str(self) -> builtins.str:
-        num, self._cur_number = self._cur_number, self._cur_number + 1
-        return self.words[num]
 
-    def _next(
-        self, parse: Callable[[builtins.str], Any], expected_type: builtins.str
-    ) -> Any:
-        value = self.str()
-        try:
-            return parse(value)
-        except Exception:
-            logging.error(f"Expected {expected_type!r}, got {value!r}")
-            raise
+def _max_volts_amps(
+    data: str, start_channel: int, amount_of_channels: int
+) -> Tuple[str, str]:
+    samples = ptd_log.decode(
+        data, keep_text=True, fields=("volts", "amps"), times=False
+    )
+    samples.check_channels(start_channel, amount_of_channels)
+    return samples.max_volts_amps(start_channel, amount_of_channels)
 
-    def is_finished(self) -> bool:
-        return self._cur_number >= len(self.words) - 1
 
+# Number of lines decoded at once by `extract_ranging_log()`.
+EXTRACT_BATCH_LINES = 16384
 
-def max_volts_amps(
-    log_fname: str, mark: str, start_channel: int, amount_of_channels: int
+
+def extract_ranging_log(
+    lines: Iterable[str],
+    out: TextIO,
+    mark: str,
+    start_channel: int,
+    amount_of_channels: int,
 ) -> Tuple[str, str]:
-    maxVolts = Decimal("-1")
-    maxAmps = Decimal("-1")
-    with open(log_fname, "r") as f:
-        for line in f:
-            m = RE_PTD_LOG.match(line.rstrip("\r\n"))
-            if m and m["mark"] == mark:
-                parser = Parser(line)
-                parser.lit("Time")
-                parser.skip()
-                parser.lit("Watts")
-                parser.skip()
-                parser.lit("Volts")
-                volts = parser.decimal()
-                parser.lit("Amps")
-                amps = parser.decimal()
-                parser.lit("PF")
-                parser.skip()
-                parser.lit("Mark")
-                parser.skip()
-                maxVolts = max(maxVolts, volts)
-                maxAmps = max(maxAmps, amps)
-                channel_range = list(
-                    range(start_channel, start_channel + amount_of_channels)
-                )
-                while not parser.is_finished():
-                    is_sutable_channel = True
-                    if not parser.check(f"Ch{channel_range[0]}"):
-                        is_sutable_channel = False
-                    else:
-                        channel_range.pop(0)
-                    parser.skip()
-                    parser.lit("Watts")
-                    parser.skip()
-                    parser.lit("Volts")
-                    volts = parser.decimal()
-                    parser.lit("Amps")
-                    amps = parser.decimal()
-                    parser.lit("PF")
-                    parser.skip()
-                    if is_sutable_channel:
-                        maxVolts = max(maxVolts, volts)
-                        maxAmps = max(maxAmps, amps)
-                if len(channel_range):
-                    raise ExtraChannelError(
-                        f"There are extra ptd channels in configuration"
-                    )
-    if maxVolts <= 0 or maxAmps <= 0:
+    """Write the log lines with the given mark into `out` and return max volts
+    and amps among them.  Equivalent to `read_log()` followed by
+    `max_volts_amps()`, but done in a single pass.
+    """
+    max_volts, max_amps = -1.0, -1.0
+    max_volts_str, max_amps_str = "-1", "-1"
+    error: Optional[Exception] = None
+    batch: List[str] = []
+
+    def flush() -> None:
+        nonlocal max_volts, max_amps, max_volts_str, max_amps_str, error
+        data = "\n".join(batch)
+        batch.clear()
+        if error is not None:
+            # Keep writing the log, report the error afterwards.
+            return
+        try:
+            volts_str, amps_str = _max_volts_amps(
+                data, start_channel, amount_of_channels
+            )
+        except Exception as e:
+            error = e
+            return
+        volts, amps = float(volts_str), float(amps_str)
+        if volts > max_volts:
+            max_volts, max_volts_str = volts, volts_str
+        if amps > max_amps:
+            max_amps, max_amps_str = amps, amps_str
+
+    for line in lines:
+        if not _has_mark(line, mark):
+            continue
+        out.write(line)
+        batch.append(line.rstrip("\r\n"))
+        if len(batch) == EXTRACT_BATCH_LINES:
+            flush()
+    flush()
+
+    if error is not None:
+        raise error
+    if max_volts <= 0 or max_amps <= 0:
         raise MaxVoltsAmpsNegativeValuesError(f"Could not find values for {mark!r}")
-    return str(maxVolts), str(maxAmps)
+    return max_volts_str, max_amps_str
 
 
 def read_log(log_fname: str, mark: str) -> str:
-    # TODO: The log file grows over time and never cleared.
-    #       Probably, we need to fseek() here instead of reading from the start.
+    # Reads the whole file.  The server uses PtdLogIndex instead.
     result = []
     with open(log_fname, "r") as f:
         for line in f:
@@ -199,6 +236,260 @@ def read_log(log_fname: str, mark: str) -> str:
     return "".join(result)
 
 
+class PtdLogIndex:
+    """Incremental reader of the PTDaemon log file (the `logFile` option).
+
+    The log file grows over time and is never cleared, so instead of scanning
+    it from the start on each `Session.stop()` we remember up to which offset
+    it has been scanned and the byte range covered by each mark.
+    """
+
+    _HEAD_LEN = 256
+
+    def __init__(self, fname: str) -> None:
+        self._fname = fname
+        self._offset = 0
+        self._head = b""
+        self._marks: Dict[str, Tuple[int, int]] = {}
+
+    def update(self) -> None:
+        """Scan the bytes appended since the previous call."""
+        try:
+            f = open(self._fname, "rb")
+        except FileNotFoundError:
+            self._reset(b"")
+            return
+
+        with f:
+            size = os.fstat(f.fileno()).st_size
+            head = f.read(self._HEAD_LEN)
+            if head[: len(self._head)] != self._head or size < self._offset:
+                # The file was truncated or overwritten, e.g. by a new PTDaemon.
+                logging.info(f"{self._fname!r} was overwritten, rescanning it")
+                self._reset(head)
+            elif len(self._head) < self._HEAD_LEN:
+                self._head = head
+
+            f.seek(self._offset)
+            while True:
+                block = f.read(LOG_INDEX_BLOCK_SIZE)
+                end = block.rfind(b"\n") + 1
+                if end == 0 and len(block) == LOG_INDEX_BLOCK_SIZE:
+                    # Garbage without newlines, not a log line anyway.
+                    end = len(block)
+                elif end == 0:
+                    # EOF or an incomplete line which is still being written.
+                    break
+                self._index_block(block, end)
+                self._offset += end
+                f.seek(self._offset)
+
+    def read(self, mark: str) -> List[str]:
+        """Return the log lines with the given mark, same as `read_log()`."""
+        return list(self.iter_lines(mark))
+
+    def iter_lines(self, mark: str) -> Iterator[str]:
+        """Same as `read()`, but reads the file block by block."""
+        self.update()
+        if mark not in self._marks:
+            return
+        begin, end = self._marks[mark]
+        with open(self._fname, "rb") as f:
+            f.seek(begin)
+            while begin < end:
+                block = f.read(min(LOG_INDEX_BLOCK_SIZE, end - begin))
+                if b"\n" in block:
+                    block = block[: block.rfind(b"\n") + 1]
+                begin += len(block)
+                f.seek(begin)
+                text = block.decode(errors="replace").replace("\r\n", "\n")
+                for line in text.split("\n"):
+                    m = RE_PTD_LOG.match(line)
+                    if m and m["mark"] == mark:
+                        yield line + "\n"
+
+    def _index_block(self, block: bytes, end: int) -> None:
+        pos = 0
+        while True:
+            m = RE_PTD_LOG_BYTES.search(block, pos, end)
+            if m is None:
+                break
+
+            # The samples of one mark go in a row until the next Go command, so
+            # skip them at once instead of matching them one by one.
+            mark_b = m["mark"]
+            pos = self._find_other_mark(block, mark_b, m.end(), end)
+            last = block.rfind(b"\n", m.start(), pos - 1) + 1
+            while last > m.start():
+                m_last = RE_PTD_LOG_BYTES.match(block, last, end)
+                if m_last is not None and m_last["mark"] == mark_b:
+                    break
+                last = block.rfind(b"\n", m.start(), last - 1) + 1
+            line_end = self._offset + block.index(b"\n", max(last, m.end())) + 1
+
+            mark = mark_b.decode(errors="replace")
+            if mark in self._marks:
+                self._marks[mark] = (self._marks[mark][0], line_end)
+            else:
+                self._marks[mark] = (self._offset + m.start(), line_end)
+
+    @staticmethod
+    def _find_other_mark(block: bytes, mark: bytes, pos: int, end: int) -> int:
+        """Return the start of the first log line having a mark other than
+        the given one, or `end` if there is no such line."""
+        re_other_mark = _re_other_mark(mark)
+        while True:
+            m = re_other_mark.search(block, pos, end)
+            if m is None:
+                return end
+            line_start = block.rfind(b"\n", 0, m.start()) + 1
+            if RE_PTD_LOG_BYTES.match(block, line_start, end):
+                return line_start
+            pos = m.end()
+
+    def _reset(self, head: bytes) -> None:
+        self._offset = 0
+        self._head = head
+        self._marks = {}
+
+
+@dataclasses.dataclass
+class ChannelStats:
+    count: int = 0
+    min_watts: float = math.inf
+    max_watts: float = -math.inf
+    sum_watts: float = 0.0
+    max_volts: float = -1.0
+    max_volts_str: str = "-1"
+    max_amps: float = -1.0
+    max_amps_str: str = "-1"
+    energy: float = 0.0  # Joules, assuming the power is held until the next sample
+    last_time: Optional[float] = None
+    last_watts: float = 0.0
+
+    @property
+    def mean_watts(self) -> float:
+        return self.sum_watts / self.count if self.count else math.nan
+
+    def add(self, t: float, watts: float, volts_str: str, amps_str: str) -> None:
+        self.count += 1
+        self.min_watts = min(self.min_watts, watts)
+        self.max_watts = max(self.max_watts, watts)
+        self.sum_watts += watts
+        volts, amps = float(volts_str), float(amps_str)
+        if volts > self.max_volts:
+            self.max_volts, self.max_volts_str = volts, volts_str
+        if amps > self.max_amps:
+            self.max_amps, self.max_amps_str = amps, amps_str
+        if self.last_time is not None and t > self.last_time:
+            self.energy += self.last_watts * (t - self.last_time)
+        self.last_time, self.last_watts = t, watts
+
+
+@dataclasses.dataclass
+class MarkStats:
+    lines: int = 0
+    errors: int = 0
+    # 0 is the total (the fields before `Mark`), N is the `ChN` group.
+    channels: Dict[int, ChannelStats] = dataclasses.field(default_factory=dict)
+
+
+class SampleAggregator:
+    """Running per-mark and per-channel statistics of the samples printed by
+    PTDaemon to its stdout.
+
+    Fed by the `Tee` thread, so the ranging results are known as soon as the
+    measurement is stopped.  PTDaemon does not necessarily echo the samples to
+    its stdout, so the results are only used when they are consistent with the
+    log file, see `max_volts_amps()`.
+    """
+
+    def __init__(self) -> None:
+        self._lock = threading.Lock()
+        self._marks: Dict[str, MarkStats] = {}
+        self._partial = ""
+
+    def feed(self, data: str) -> None:
+        """Add a chunk of the PTDaemon output.  Lines may be split across
+        chunks."""
+        lines = (self._partial + data).split("\n")
+        self._partial = lines.pop()
+        for line in lines:
+            self.add_line(line)
+
+    def add_line(self, line: str) -> None:
+        # The line may have a prefix (e.g. a timestamp) before the sample.
+        pos = line.find("Time,")
+        if pos < 0:
+            return
+        line = line[pos:].rstrip()
+        m = RE_PTD_LOG.match(line)
+        if m is None:
+            return
+        with self._lock:
+            stats = self._marks.setdefault(m["mark"], MarkStats())
+            stats.lines += 1
+            try:
+                samples = _samples(line)
+            except Exception:
+                stats.errors += 1
+                return
+            for channel, t, watts, volts_str, amps_str in samples:
+                if channel not in stats.channels:
+                    stats.channels[channel] = ChannelStats()
+                stats.channels[channel].add(t, watts, volts_str, amps_str)
+
+    def stats(self, mark: str) -> Optional[MarkStats]:
+        with self._lock:
+            stats = self._marks.get(mark)
+            return None if stats is None else copy.deepcopy(stats)
+
+    def max_volts_amps(
+        self, mark: str, start_channel: int, amount_of_channels: int, lines: int
+    ) -> Optional[Tuple[str, str]]:
+        """Same as `max_volts_amps_lines()` for the given mark.
+
+        `lines` is the number of the log file lines with this mark.  Return
+        None if the samples seen so far do not match them or if
+        `max_volts_amps_lines()` would raise an error, so the caller could
+        fall back to the log file.
+        """
+        with self._lock:
+            stats = self._marks.get(mark)
+            if stats is None or stats.errors or stats.lines != lines:
+                return None
+            channels = [0]
+            channels += range(start_channel, start_channel + amount_of_channels)
+            for channel in stats.channels:
+                if channel != 0 and channel >= start_channel + amount_of_channels:
+                    return None  # extra channel in the log
+            for channel in channels:
+                if channel not in stats.channels:
+                    return None
+                if stats.channels[channel].count != stats.lines:
+                    return None  # extra channel in the configuration
+            suitable = [stats.channels[channel] for channel in channels]
+            volts = max(suitable, key=lambda c: c.max_volts)
+            amps = max(suitable, key=lambda c: c.max_amps)
+            if volts.max_volts <= 0 or amps.max_amps <= 0:
+                return None
+            return volts.max_volts_str, amps.max_amps_str
+
+
+def _samples(line: str) -> List[Tuple[int, float, float, str, str]]:
+    """Split a log line into (channel, time, watts, volts, amps) tuples."""
+    words = ptd_log.split(line)
+    ts = ptd_log.parse_time(words[1]) / 1e9
+    result = [(0, ts, float(words[3]), words[5], words[7])]
+
+    for i in ptd_log.channel_groups(len(words)):
+        channel = ptd_log.channel(words[i])
+        if channel <= result[-1][0]:
+            raise ValueError(f"Unexpected channel order: {line!r}")
+        result.append((channel, ts, float(words[i + 2]), words[i + 4], words[i + 6]))
+    return result
+
+
 def exit_with_error_msg(error_msg: str) -> NoReturn:
     logging.fatal(error_msg)
     exit(1)
@@ -226,6 +517,91 @@ def get_host_port_from_listen_string(listen_str: str) -> Tuple[str, int]:
     return (host, int_port)
 
 
+class AnalyzerConfig:
+    """Options of a `[ptd]` or `[ptd.NAME]` section."""
+
+    def __init__(self, name: str, section: str, get: Callable[..., Any]) -> None:
+        def parse_channel(channel_value: str) -> List[int]:
+            return [int(s) for s in channel_value.split(",")]
+
+        def parse_bool(value: str) -> bool:
+            return configparser.ConfigParser.BOOLEAN_STATES[value.lower()]
+
+        self.name = name
+        self.section = section
+        self.channel: Optional[List[int]] = get(
+            section, "channel", parse=parse_channel, fallback=None
+        )
+        self.device_type: int = get(section, "deviceType", parse=int)
+        interface_flag: str = get(section, "interfaceFlag")
+        device_port: str = get(section, "devicePort")
+        board_num: Optional[int] = get(section, "gpibBoard", parse=int, fallback=None)
+        # TODO: validate interface_flag?
+        # TODO: validate device_type?
+        self.logfile: str = get(section, "logfile")
+        self.port: int = get(section, "networkPort", parse=int, fallback="8888")
+        self.keep_running: bool = get(
+            section, "keepRunning", parse=parse_bool, fallback="no"
+        )
+        self.command: List[str] = [
+            get(section, "ptd"),
+            "-l",
+            self.logfile,
+            "-p",
+            str(self.port),
+            *([] if board_num is None else ["-b", str(board_num)]),
+            *(
+                []
+                if self.channel is None
+                else ["-c", ",".join(str(x) for x in self.channel)]
+            ),
+            *([] if interface_flag == "" else [interface_flag]),
+            str(self.device_type),
+            device_port,
+        ]
+
+        self.summary: Dict[str, Any] = {
+            "command": self.command,
+            "device_type": self.device_type,
+            "interface_flag": interface_flag,
+            "device_port": device_port,
+            "channel": self.channel,
+        }
+
+    def check(self, filename: str) -> None:
+        path = Path(self.logfile)
+        if not (path.parent.exists()):
+            exit_with_error_msg(
+                f"{filename}: {str(path.parent)!r} does not exist. Please create {str(path.parent)!r} folder."
+            )
+
+        if tcp_port_is_occupied(self.port):
+            exit_with_error_msg(f"The PTDaemon port {self.port} is already occupied.")
+
+        if self.device_type in MULTICHANNEL_DEVICES:
+            if not self.channel:
+                exit_with_error_msg(
+                    f"{filename}: 'channel' value should be set for"
+                    f" a multichannel device {self.device_type}."
+                )
+            if self.device_type == DEVICE_TYPE_WT500 and len(self.channel) != 1:
+                exit_with_error_msg(
+                    f"{filename}: 'channel' value should consist of one number"
+                    f" for a multichannel device {self.device_type} (Yokogawa WT500)."
+                )
+            if len(self.channel) != 2:
+                exit_with_error_msg(
+                    f"{filename}: 'channel' value should consist of two numbers"
+                    f" for a multichannel device {self.device_type}."
+                )
+        else:
+            if self.channel and len(self.channel) != 1:
+                exit_with_error_msg(
+                    f"{filename}: 'channel' value should consist of one number"
+                    f" or be disabled for a 1-channel device {self.device_type}."
+                )
+
+
 class ServerConfig:
     def __init__(self, filename: str) -> None:
         conf = configparser.ConfigParser()
@@ -237,9 +613,6 @@ class ServerConfig:
         _UNSET = object()
         used: Dict[str, Set[str]] = {}
 
-        def parse_channel(channel_value: str) -> List[int]:
-            return [int(s) for s in channel_value.split(",")]
-
         def get(
             section: str,
             option: str,
@@ -276,42 +649,29 @@ class ServerConfig:
             parse=get_host_port_from_listen_string,
             fallback=f"0.0.0.0 {common.DEFAULT_PORT}",
         )
+        self.transport: str = get("server", "transport", fallback="select")
+        if self.transport not in common.TRANSPORTS:
+            exit_with_error_msg(
+                f"{filename}: 'transport' should be one of"
+                f" {', '.join(common.TRANSPORTS)}, got {self.transport!r}"
+            )
 
-        self.ptd_channel: Optional[List[int]] = get(
-            "ptd", "channel", parse=parse_channel, fallback=None
-        )
-        self.ptd_device_type: int = get("ptd", "deviceType", parse=int)
-        ptd_interface_flag: str = get("ptd", "interfaceFlag")
-        ptd_device_port: str = get("ptd", "devicePort")
-        ptd_board_num: Optional[int] = get("ptd", "gpibBoard", parse=int, fallback=None)
-        # TODO: validate ptd_interface_flag?
-        # TODO: validate ptd_device_type?
-        self.ptd_logfile: str = get("ptd", "logfile")
-        self.ptd_port: int = get("ptd", "networkPort", parse=int, fallback="8888")
-        self.ptd_command: List[str] = [
-            get("ptd", "ptd"),
-            "-l",
-            self.ptd_logfile,
-            "-p",
-            str(self.ptd_port),
-            *([] if ptd_board_num is None else ["-b", str(ptd_board_num)]),
-            *(
-                []
-                if self.ptd_channel is None
-                else ["-c", ",".join(str(x) for x in self.ptd_channel)]
-            ),
-            *([] if ptd_interface_flag == "" else [ptd_interface_flag]),
-            str(self.ptd_device_type),
-            ptd_device_port,
-        ]
-
-        self.ptd_summary: Dict[str, Any] = {
-            "command": self.ptd_command,
-            "device_type": self.ptd_device_type,
-            "interface_flag": ptd_interface_flag,
-            "device_port": ptd_device_port,
-            "channel": self.ptd_channel,
+        # The `[ptd]` section is the default analyzer.  Each `[ptd.NAME]`
+        # section adds an analyzer selected by the client with `--analyzer NAME`.
+        self.analyzers: Dict[str, AnalyzerConfig] = {
+            "": AnalyzerConfig("", "ptd", get)
         }
+        for section in conf.sections():
+            if section.startswith("ptd."):
+                name = section[len("ptd.") :]
+                if not common.check_label(name) or name == "":
+                    exit_with_error_msg(
+                        f"{filename}: invalid analyzer name {name!r} in {section!r}"
+                    )
+                self.analyzers[name] = AnalyzerConfig(name, section, get)
+
+        # Serve clients concurrently when there are several analyzers.
+        self.threaded = len(self.analyzers) > 1
 
         for section, used_items in used.items():
             unused_options = conf[section].keys() - set((i.lower() for i in used_items))
@@ -321,7 +681,10 @@ class ServerConfig:
                     f"{', '.join(unused_options)}"
                 )
 
-        unused_sections = set(conf.sections()) - {"server", "ptd"}
+        unused_sections = set(conf.sections()) - {
+            "server",
+            *(analyzer.section for analyzer in self.analyzers.values()),
+        }
         if len(unused_sections) != 0:
             logging.warning(
                 f"{filename}: ignoring unknown sections: {', '.join(unused_sections)}"
@@ -331,43 +694,39 @@ class ServerConfig:
         self._check(filename)
 
     def _check(self, filename: str) -> None:
-        path = Path(self.ptd_logfile)
-        if not (path.parent.exists()):
-            exit_with_error_msg(
-                f"{filename}: {str(path.parent)!r} does not exist. Please create {str(path.parent)!r} folder."
-            )
-
-        if tcp_port_is_occupied(self.ptd_port):
-            exit_with_error_msg(
-                f"The PTDaemon port {self.ptd_port} is already occupied."
-            )
-
-        if self.ptd_device_type in MULTICHANNEL_DEVICES:
-            if not self.ptd_channel:
-                exit_with_error_msg(
-                    f"{filename}: 'channel' value should be set for"
-                    f" a multichannel device {self.ptd_device_type}."
-                )
-            if self.ptd_device_type == DEVICE_TYPE_WT500 and len(self.ptd_channel) != 1:
-                exit_with_error_msg(
-                    f"{filename}: 'channel' value should consist of one number"
-                    f" for a multichannel device {self.ptd_device_type} (Yokogawa WT500)."
-                )
-            if len(self.ptd_channel) != 2:
-                exit_with_error_msg(
-                    f"{filename}: 'channel' value should consist of two numbers"
-                    f" for a multichannel device {self.ptd_device_type}."
-                )
-        else:
-            if self.ptd_channel and len(self.ptd_channel) != 1:
-                exit_with_error_msg(
-                    f"{filename}: 'channel' value should consist of one number"
-                    f" or be disabled for a 1-channel device {self.ptd_device_type}."
-                )
+        for analyzer in self.analyzers.values():
+            analyzer.check(filename)
+
+        for attr, what in [("port", "networkPort"), ("logfile", "logFile")]:
+            seen: Dict[Any, str] = {}
+            for analyzer in self.analyzers.values():
+                value = getattr(analyzer, attr)
+                if attr == "logfile":
+                    value = os.path.abspath(value)
+                if value in seen:
+                    exit_with_error_msg(
+                        f"{filename}: {seen[value]!r} and {analyzer.section!r}"
+                        f" have the same {what!r}"
+                    )
+                seen[value] = analyzer.section
 
 
 class Ptd:
-    def __init__(self, command: List[str], port: int, log_dir_path: str) -> None:
+    """A PTDaemon process and its control connection.
+
+    Normally each session runs its own PTDaemon, terminated by `release()`.
+    With `keep_running`, the process stays up between sessions: `release()`
+    only stops the measurement and restores the initial ranges, and the next
+    session `attach()`es to it.  PTDaemon is restarted only if it has failed.
+    """
+
+    def __init__(
+        self,
+        command: List[str],
+        port: int,
+        log_dir_path: str,
+        keep_running: bool = False,
+    ) -> None:
         self._process: Optional[subprocess.Popen[Any]] = None
         self._socket: Optional[socket.socket] = None
         self._proto: Optional[common.Proto] = None
@@ -379,22 +738,48 @@ class Ptd:
         self._tee: Optional[Tee] = None
         self._log_dir_path = log_dir_path
         self._messages = summarylib.PtdMessages()
+        self.samples = SampleAggregator()
+        self._keep_running = keep_running
+        self._handoff_pending = False
+        self._launches = 0
+        self._handoffs = 0
+
+    def attach(self, log_dir_path: str) -> None:
+        """Hand a kept running PTDaemon over to a new session.  The
+        connection is checked by the next `start()`."""
+        self._log_dir_path = log_dir_path
+        self._messages = summarylib.PtdMessages()
+        self.samples = SampleAggregator()
+        self._handoff_pending = self._process is not None
+
+    def supervisor_summary(self) -> Optional[Dict[str, int]]:
+        if not self._keep_running:
+            return None
+        return {"restarts": max(self._launches - 1, 0), "handoffs": self._handoffs}
 
     def start(self) -> None:
         try:
             self._start()
-        except Exception:
+        except Exception as e:
             logging.exception("Could not start PTDaemon")
-            exit(1)
+            raise PtdError("Could not start PTDaemon") from e
 
     def _start(self) -> None:
         if self._process is not None:
-            return
+            if not self._handoff_pending or self._handoff():
+                return
+        self._handoff_pending = False
         if tcp_port_is_occupied(self._port):
             raise RuntimeError(f"The PTDaemon port {self._port} is already occupied")
         logging.info(f"Running PTDaemon: {self._command}")
+        started = time.monotonic()
 
-        self._tee = Tee(os.path.join(self._log_dir_path, "ptd_logs.txt"))
+        self._tee = Tee(
+            os.path.join(self._log_dir_path, "ptd_logs.txt"),
+            self.samples,
+            banner=self._keep_running,
+        )
+        self._launches += 1
         env = os.environ
         env["TZ"] = "UTC"
         if sys.platform == "win32":
@@ -421,26 +806,7 @@ class Ptd:
             )
         self._tee.started()
 
-        # Linux PTDaemon connected to WT333E over USB takes 17 seconds to fire
-        # up.  We wait for 30 seconds to be sure.
-        retries = 300
-
-        s = None
-        while s is None and retries > 0:
-            if self._process is not None and self._process.poll() is not None:
-                raise RuntimeError("PTDaemon unexpectedly terminated")
-            s = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
-            try:
-                s.connect(("127.0.0.1", self._port))
-            except ConnectionRefusedError:
-                if common.sig.stopped:
-                    exit()
-                time.sleep(0.1)
-                s = None
-                retries -= 1
-        if s is None:
-            self.terminate()
-            raise RuntimeError("Could not connect to PTDaemon")
+        s = self._wait_ready(started)
         self._socket = s
         self._proto = common.Proto(s)
 
@@ -453,10 +819,116 @@ class Ptd:
 
         self._get_initial_range()
 
+        if self._keep_running:
+            # The uncertainty checking message of the startup output is
+            # replayed into ptd_logs.txt of the next sessions.
+            self._tee.mark_banner()
+
+    def _wait_ready(self, started: float) -> socket.socket:
+        """Connect to the starting PTDaemon.  PTDaemon starts listening after
+        writing its startup messages, so connecting is retried whenever it
+        writes something.  Its exit is seen as the end of its output."""
+        assert self._process is not None and self._tee is not None
+        deadline = started + PTD_START_TIMEOUT_SECONDS
+        attempts = 0
+        delay = PTD_CONNECT_RETRY_SECONDS[0]
+        output = self._tee.output_count()
+        while True:
+            if self._tee.eof() or self._process.poll() is not None:
+                raise RuntimeError(
+                    "PTDaemon unexpectedly terminated after"
+                    f" {time.monotonic() - started:.3f} seconds"
+                )
+            attempts += 1
+            s = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+            try:
+                s.connect(("127.0.0.1", self._port))
+                break
+            except ConnectionRefusedError:
+                s.close()
+            if common.sig.stopped:
+                exit()
+            if time.monotonic() > deadline:
+                self.terminate()
+                raise RuntimeError("Could not connect to PTDaemon")
+
+            new_output = self._tee.wait_output(output, delay)
+            if new_output != output:
+                delay = PTD_CONNECT_RETRY_SECONDS[0]
+            else:
+                delay = min(delay * 2, PTD_CONNECT_RETRY_SECONDS[1])
+            output = new_output
+
+        logging.info(
+            f"PTDaemon is listening after {time.monotonic() - started:.3f} seconds"
+            f" ({attempts} connection attempts)"
+        )
+        return s
+
+    def _handoff(self) -> bool:
+        """Check the kept running PTDaemon and greet it on behalf of the new
+        session like a fresh start does.  Return False if it has failed and
+        should be restarted."""
+        assert self._tee is not None and self._proto is not None
+        self._handoff_pending = False
+
+        reply = None
+        if self._process is not None and self._process.poll() is None:
+            self._tee.redirect(
+                os.path.join(self._log_dir_path, "ptd_logs.txt"), self.samples
+            )
+            logging.info("Sending to ptd: 'Hello'")
+            try:
+                self._proto.send("Hello")
+                reply = self._proto.recv()
+            except OSError:
+                logging.exception("Could not reach PTDaemon")
+        if reply != "Hello, PTDaemon here!":
+            logging.warning(f"PTDaemon has failed (reply {reply!r}), restarting it")
+            self._proto = None
+            if self._socket is not None:
+                self._socket.close()
+                self._socket = None
+            self._force_terminate()
+            return False
+        logging.info(f"Reply from ptd: {reply!r}")
+        self._messages.add("Hello", reply)
+
+        self.cmd("Identify")  # reply traced in logs
+        self._get_initial_range()
+        self._handoffs += 1
+        logging.info(f"Reusing the running PTDaemon (handoff {self._handoffs})")
+        return True
+
     def stop(self) -> None:
         self.cmd("Stop")
 
-    def terminate(self) -> None:
+    def release(self) -> None:
+        """End of the session: terminate PTDaemon, or with `keep_running`,
+        restore its initial ranges and keep it for the next session."""
+        if not self._keep_running or self._process is None:
+            self.terminate()
+            return
+        if self._process.poll() is not None:
+            logging.warning("PTDaemon unexpectedly terminated")
+            self._proto = None
+            self.terminate()
+            return
+        if self._proto is None:
+            logging.warning("Lost the connection to PTDaemon, stopping it")
+            self.terminate()
+            return
+        try:
+            self._restore_initial_range()
+        except PtdError:
+            self.terminate()
+            raise
+        assert self._tee is not None
+        # Keep the rest of the output out of ptd_logs.txt, it is about to be
+        # hashed.
+        self._tee.redirect(None, None)
+
+    def _restore_initial_range(self) -> None:
         if self._proto is not None:
             self.cmd("Stop")
             self.cmd(f"SR,V,{self._init_Volts}")
@@ -464,6 +936,13 @@ class Ptd:
             logging.info(
                 f"Set initial values for Amps {self._init_Amps} and Volts {self._init_Volts}"
             )
+
+    def terminate(self) -> None:
+        if self._proto is not None:
+            try:
+                self._restore_initial_range()
+            except PtdError as e:
+                logging.error(f"Could not restore the initial ranges: {e}")
             self._proto = None
 
         if self._socket is not None:
@@ -495,28 +974,59 @@ class Ptd:
             self._tee.done()
             self._tee = None
 
-    def cmd(self, cmd: str) -> Optional[str]:
+    def cmd(self, cmd: str, record: bool = True) -> Optional[str]:
+        """Send the command to PTDaemon and return the reply.  Unless `record`
+        is False, the pair is saved into ptd_messages of server.json, which the
+        compliance checker expects in a fixed order."""
         if self._proto is None:
             return None
         if self._process is None or self._process.poll() is not None:
-            exit_with_error_msg("PTDaemon unexpectedly terminated")
+            self._proto = None
+            raise PtdError("PTDaemon unexpectedly terminated")
         logging.info(f"Sending to ptd: {cmd!r}")
-        self._proto.send(cmd)
-        reply = self._proto.recv()
+        try:
+            self._proto.send(cmd)
+            reply = self._proto.recv()
+        except OSError as e:
+            self._proto = None
+            raise PtdError(f"Could not reach PTDaemon: {e}") from e
         if reply is None:
-            exit_with_error_msg("Got no reply from PTDaemon")
+            self._proto = None
+            raise PtdError("Got no reply from PTDaemon")
         logging.info(f"Reply from ptd: {reply!r}")
-        self._messages.add(cmd, reply)
+        if record:
+            self._messages.add(cmd, reply)
         return reply
 
+    def ranges_applied(self, volts: str, amps: str) -> bool:
+        """Check with RR that the analyzer has switched to the ranges set with
+        `SR,V,{volts}` and `SR,A,{amps}`.  The number of polls depends on the
+        timing, so they are not recorded."""
+        response = self.cmd("RR", record=False)
+        response_list = ("" if response is None else response).split(",")
+        if len(response_list) < 5:
+            return False
+
+        def applied(autorange: str, value: str, requested: str) -> bool:
+            if requested == "Auto":
+                return autorange == "1"
+            try:
+                # The analyzer picks the nearest range not below the value.
+                return autorange == "0" and float(value) >= float(requested)
+            except ValueError:
+                return False
+
+        return applied(response_list[1], response_list[2], amps) and applied(
+            response_list[3], response_list[4], volts
+        )
+
     def _get_initial_range(self) -> None:
         # Normal Response: ?Ranges,{Amp Autorange},{Amp Range},{Volt Autorange},{Volt Range}\r\n?
         # Values: for autorange settings, -1 indicates ?unknown?, 0 = disabled, 1 = enabled
         # For range values, -1.0 indicates ?unknown?, >0 indicates actual value
         response = self.cmd("RR")
         if response is None or response == "":
-            logging.error("Can not get initial range")
-            exit(1)
+            raise PtdError("Can not get initial range")
 
         response_list = response.split(",")
 
@@ -539,19 +1049,127 @@ class Ptd:
         )
 
 
+class Analyzer:
+    """A power analyzer and its PTDaemon log, used by one session at a time."""
+
+    def __init__(self, config: AnalyzerConfig) -> None:
+        self.config = config
+        self.log = PtdLogIndex(config.logfile)
+        self._lock = threading.Lock()
+        self._ptd: Optional[Ptd] = None
+
+    def ptd(self, log_dir_path: str) -> Ptd:
+        """PTDaemon for a new session, writing its output to log_dir_path.
+        With `keepRunning`, the same PTDaemon is handed over from session to
+        session."""
+        if not self.config.keep_running:
+            return Ptd(self.config.command, self.config.port, log_dir_path)
+        if self._ptd is None:
+            self._ptd = Ptd(
+                self.config.command, self.config.port, log_dir_path, keep_running=True
+            )
+        self._ptd.attach(log_dir_path)
+        return self._ptd
+
+    def close(self) -> None:
+        if self._ptd is not None:
+            self._ptd.terminate()
+            self._ptd = None
+
+    def acquire(self) -> None:
+        if self._lock.acquire(blocking=False):
+            return
+        logging.info(
+            f"Waiting for the analyzer {self.config.section!r}"
+            " to be released by another session"
+        )
+        while not self._lock.acquire(timeout=0.5):
+            common.sig.check()
+
+    def release(self) -> None:
+        self._lock.release()
+
+
 class Server:
     def __init__(self, config: ServerConfig) -> None:
-        self.session: Optional[Session] = None
         self._config = config
         self._stop = False
+        self._lock = threading.Lock()
+        self._connections: Set[Connection] = set()
+        # Held while stepping the clock and while creating a session.
+        self._clock_lock = threading.Lock()
+        self._analyzers: Dict[str, Analyzer] = {}
+        for name, analyzer_config in config.analyzers.items():
+            analyzer = Analyzer(analyzer_config)
+            logging.info(f"Indexing PTDaemon log file {analyzer_config.logfile!r}")
+            analyzer.log.update()
+            self._analyzers[name] = analyzer
+
+    def handle_connection(self, p: common.Proto) -> None:
+        connection = Connection(self)
+        with self._lock:
+            if self._stop:
+                logging.info("Refusing the connection, the server is stopping")
+                return
+            self._connections.add(connection)
+        try:
+            connection.handle(p)
+        finally:
+            # The other connections are left to finish their sessions on their
+            # own threads; the last one to finish stops the server.
+            with self._lock:
+                self._connections.discard(connection)
+                last = not self._connections
+
+            if self._stop:
+                if last:
+                    logging.info("Stopping the server")
+                    exit(0)
+                logging.info(
+                    "The server will be stopped after the other connections finish"
+                )
+
+    def set_ntp(self, connection: "Connection") -> bool:
+        """Step the clock with NTP, unless another connection has a session:
+        its timestamps would not match PTDaemon's."""
+        with self._clock_lock:
+            with self._lock:
+                others = [c for c in self._connections if c is not connection]
+            if any(c.session is not None for c in others):
+                logging.warning(
+                    "Not setting the time with NTP, other sessions are active"
+                )
+                return False
+            time_sync.set_ntp(self._config.ntp_server)
+            return True
+
+    def close(self) -> None:
+        with self._lock:
+            connections = list(self._connections)
+        for connection in connections:
+            connection.close()
+        for analyzer in self._analyzers.values():
+            analyzer.close()
+
+
+class Connection:
+    """A client connection.  Each connection has its own session, summary and
+    server.log, so the connections could be handled concurrently."""
+
+    def __init__(self, server: Server) -> None:
+        self._server = server
+        self._config = server._config
+        self.session: Optional[Session] = None
         self._summary: Optional[summarylib.Summary] = None
         self._last_session: Optional[str] = None
         self._last_session_dir_path: Optional[str] = None
+        self._log_thread = threading.get_ident()
+        self._lock = threading.Lock()
 
-    def handle_connection(self, p: common.Proto) -> None:
+    def handle(self, p: common.Proto) -> None:
         p.enable_keepalive()
         self._summary = summarylib.Summary()
-        self._summary.ptd_config = self._config.ptd_summary
+        self._summary.ptd_config = self._config.analyzers[""].summary
         self._summary.debug = _debug
         self._last_session = self._last_session_dir_path = None
 
@@ -565,6 +1183,7 @@ class Server:
             logging.error(
                 f"Handshake failed, expected {common.MAGIC_CLIENT!r}, got {magic!r}"
             )
+            common.log_redirect.stop()
             return
 
         try:
@@ -580,6 +1199,10 @@ class Server:
                     reply = self._handle_cmd(cmd, p)
                 except KeyboardInterrupt:
                     break
+                except PtdError:
+                    # Only this connection is ended, its session and PTDaemon
+                    # are dropped below.
+                    raise
                 except MeasurementEndedTooFastError as e:
                     logging.error(f"Got an exception: {e.args[0]}")
                     reply = f"Error: {e.args[0]}"
@@ -603,11 +1226,7 @@ class Server:
         finally:
             if self.session is not None:
                 logging.warning("Client connection closed unexpectedly")
-                self._drop_session()
-
-            if self._stop:
-                logging.info("Stopping the server")
-                exit(0)
+            self._drop_session()
 
             self._last_session = self._last_session_dir_path = None
 
@@ -618,21 +1237,33 @@ class Server:
         if cmd[0] == "time":
             return str(time.time())
         if cmd[0] == "set_ntp":
-            time_sync.set_ntp(self._config.ntp_server)
+            if not self._server.set_ntp(self):
+                return "Error: other sessions are active"
             return "OK"
         if cmd[0] == "stop":
             logging.info("The server will be stopped after processing this client")
-            self._stop = True
+            self._server._stop = True
             return "OK"
-        if cmd[0] == "new" and len(cmd) == 3:
+        if cmd[0] == "new" and len(cmd) in (3, 4):
             if self.session is not None:
                 self.session.drop()
+                self.session = None
             if not common.check_label(cmd[1]):
                 return "Error: invalid label"
+            analyzer = self._server._analyzers.get(cmd[3] if len(cmd) == 4 else "")
+            if analyzer is None:
+                return "Error: unknown analyzer"
             assert self._summary is not None
             self._summary.client_uuid = uuid.UUID(cmd[2])
             self._summary.server_uuid = uuid.uuid4()
-            self.session = Session(self, cmd[1])
+            self._summary.ptd_config = analyzer.config.summary
+            analyzer.acquire()
+            try:
+                with self._server._clock_lock:
+                    self.session = Session(self, analyzer, cmd[1])
+            except BaseException:
+                analyzer.release()
+                raise
             self._summary.session_name = self.session._id
             self._last_session = self.session._id
             self._last_session_dir_path = self.session.log_dir_path
@@ -664,15 +1295,16 @@ class Server:
                 )
                 result = False
                 try:
-                    p.recv_file(fname)
+                    sha1 = p.recv_file(fname)
                     if cmd[1] == "ranging":
                         result = self.session.upload(Mode.RANGING, fname)
                     elif cmd[1] == "testing":
                         result = self.session.upload(Mode.TESTING, fname)
                     elif cmd[1] in ("client.json", "client.log"):
-                        shutil.copyfile(
-                            fname, os.path.join(self.session.power_logs, cmd[1])
-                        )
+                        dest = os.path.join(self.session.power_logs, cmd[1])
+                        shutil.copyfile(fname, dest)
+                        assert self._summary is not None
+                        self._summary.known_hash(dest, sha1)
                         result = True
                     else:
                         result = False
@@ -684,6 +1316,27 @@ class Server:
                         pass
                 return unbool[result]
 
+            if (
+                len(cmd) == 2
+                and cmd[0] == "upload_stream"
+                and cmd[1] in ["ranging", "testing"]
+            ):
+                mode = Mode.RANGING if cmd[1] == "ranging" else Mode.TESTING
+                dirname = self.session.upload_dir(mode)
+                # Receive the files even in an unexpected state, otherwise
+                # they would be taken for commands.
+                received = p.recv_dir(dirname)
+                logging.info(
+                    f"Received {len(received)} files into {dirname!r}"
+                    if dirname is not None
+                    else "Discarded the files, unexpected session state"
+                )
+                if dirname is not None:
+                    assert self._summary is not None
+                    for relpath, sha1 in received.items():
+                        self._summary.known_hash(os.path.join(dirname, relpath), sha1)
+                return unbool[dirname is not None]
+
             if cmd == ["done"]:
                 self._drop_session()
                 return "OK"
@@ -702,23 +1355,27 @@ class Server:
         return "Error"
 
     def _drop_session(self) -> None:
-        if self.session is None:
-            common.log_redirect.stop()
-            return
+        with self._lock:
+            session, self.session = self.session, None
+            summary, self._summary = self._summary, None
+            if session is None:
+                common.log_redirect.stop(thread=self._log_thread)
+                return
 
-        power_logs = self.session.power_logs
-        log_dir_path = self.session.log_dir_path
-        ptd_messages = self.session._ptd._messages
-        session, self.session = self.session, None
-        summary, self._summary = self._summary, None
+        power_logs = session.power_logs
+        log_dir_path = session.log_dir_path
+        ptd_messages = session._ptd._messages
 
         try:
             session.drop()
         finally:
-            common.log_redirect.stop(os.path.join(power_logs, "server.log"))
+            common.log_redirect.stop(
+                os.path.join(power_logs, "server.log"), self._log_thread
+            )
 
         if summary is not None:
             summary.ptd_messages = ptd_messages
+            summary.ptd_supervisor = session._ptd.supervisor_summary()
             summary.hash_results(log_dir_path)
             summary.save(os.path.join(power_logs, "server.json"))
 
@@ -741,10 +1398,24 @@ class Mode(Enum):
 
 
 class Tee:
-    def __init__(self, fname: str) -> None:
+    def __init__(
+        self,
+        fname: str,
+        samples: Optional[SampleAggregator] = None,
+        banner: bool = False,
+    ) -> None:
+        """With `banner`, the output is collected until `mark_banner()`, and
+        its RE_PTD_BANNER_LINE lines are replayed by `redirect()`."""
         self._closed = False
+        self._samples = samples
+        self._lock = threading.Lock()
+        self._banner: Optional[bytearray] = bytearray() if banner else None
+        self._banner_done = False
+        self._output = threading.Condition(self._lock)
+        self._output_count = 0
+        self._eof = False
         self._r, self.w = os.pipe()
-        self._f = open(fname, "wb")
+        self._f: Optional[BinaryIO] = open(fname, "wb")
         self._thread = threading.Thread(target=self._run)
         self._thread.daemon = True
         self._thread.start()
@@ -762,34 +1433,123 @@ class Tee:
             self._closed = True
         self._thread.join()
 
+    def output_count(self) -> int:
+        """The number of pieces of output read so far."""
+        with self._lock:
+            return self._output_count
+
+    def eof(self) -> bool:
+        with self._lock:
+            return self._eof
+
+    def wait_output(self, count: int, timeout: float) -> int:
+        """Wait until there is more output than `count` pieces, the output
+        ends, or the timeout expires.  Return the new count."""
+        with self._output:
+            self._output.wait_for(
+                lambda: self._output_count != count or self._eof, timeout
+            )
+            return self._output_count
+
+    def mark_banner(self) -> None:
+        """End the banner with the output written so far.  Only the complete
+        RE_PTD_BANNER_LINE lines are kept, between PTD_BANNER_BEGIN and
+        PTD_BANNER_END."""
+        self.settle()
+        with self._lock:
+            self._banner_done = True
+            if self._banner is not None:
+                lines = self._banner.splitlines(keepends=True)
+                self._banner = bytearray(PTD_BANNER_BEGIN)
+                for line in lines:
+                    if line.endswith(b"\n") and RE_PTD_BANNER_LINE.search(line):
+                        self._banner += line
+                self._banner += PTD_BANNER_END
+
+    def redirect(
+        self, fname: Optional[str], samples: Optional[SampleAggregator]
+    ) -> None:
+        """Write the output to another file (starting with the banner, if
+        marked), or only to stderr if fname is None, and feed it to other
+        samples."""
+        self.settle()
+        with self._lock:
+            if self._f is not None:
+                self._f.close()
+                self._f = None
+            if fname is not None:
+                self._f = open(fname, "wb")
+                if self._banner is not None and self._banner_done:
+                    self._f.write(self._banner)
+            self._samples = samples
+
+    def settle(self, timeout: float = 1.0) -> None:
+        """Wait a bit for the output written so far to be processed."""
+        if sys.platform == "win32":
+            time.sleep(0.1)  # select() does not support pipes on Windows
+            return
+        deadline = time.monotonic() + timeout
+        while time.monotonic() < deadline:
+            with self._lock:
+                if self._eof or not select.select([self._r], [], [], 0)[0]:
+                    return
+            time.sleep(0.01)
+
     def _run(self) -> None:
         try:
             while True:
-                rd = os.read(self._r, 1024)
+                if sys.platform == "win32":
+                    rd = os.read(self._r, 1024)
+                    with self._lock:
+                        self._write(rd)
+                else:
+                    # Read and process under the lock, so settle() does not
+                    # see an empty pipe while a chunk is still being written.
+                    select.select([self._r], [], [])
+                    with self._lock:
+                        rd = os.read(self._r, 1024)
+                        self._write(rd)
                 if len(rd) == 0:
                     break
-                rd_str = rd.decode(errors="ignore")
-                sys.stderr.write(rd_str)
-                sys.stderr.flush()
-                self._f.write(rd)
         finally:
-            self._f.close()
+            with self._lock:
+                if self._f is not None:
+                    self._f.close()
+                    self._f = None
+                self._eof = True
+                self._output.notify_all()
             os.close(self._r)
 
+    def _write(self, rd: bytes) -> None:
+        """Called with the lock held."""
+        if len(rd) != 0:
+            self._output_count += 1
+            self._output.notify_all()
+        rd_str = rd.decode(errors="ignore")
+        sys.stderr.write(rd_str)
+        sys.stderr.flush()
+        if self._f is not None:
+            self._f.write(rd)
+        if self._banner is not None and not self._banner_done:
+            self._banner += rd
+        if self._samples is not None:
+            self._samples.feed(rd_str)
+
 
 class Session:
-    def __init__(self, server: Server, label: str) -> None:
-        self._server: Server = server
+    def __init__(self, connection: Connection, analyzer: Analyzer, label: str) -> None:
+        """The analyzer should be acquired by the caller; it is released by
+        `drop()`."""
+        self._connection: Connection = connection
+        self._analyzer = analyzer
         self._go_command_time: Optional[float] = None
         timestamp = datetime.datetime.now().strftime("%Y-%m-%d_%H-%M-%S")
         self._id: str = timestamp + "_" + label if label != "" else timestamp
-        self.log_dir_path = os.path.join(self._server._config.out_dir, self._id)
+        self.log_dir_path = os.path.join(connection._config.out_dir, self._id)
         os.mkdir(self.log_dir_path)
-        self.power_logs = os.path.join(self._server._config.out_dir, self._id, "power")
+        self.power_logs = os.path.join(connection._config.out_dir, self._id, "power")
         os.mkdir(self.power_logs)
-        self._ptd = Ptd(
-            server._config.ptd_command, server._config.ptd_port, self.power_logs
-        )
+        self._ptd = analyzer.ptd(self.power_logs)
 
         # State
         self._state = SessionState.INITIAL
@@ -802,42 +1562,42 @@ class Session:
         if mode == Mode.TESTING and self._state == SessionState.TESTING:
             return True
 
-        assert self._server._summary is not None
+        assert self._connection._summary is not None
 
         if mode == Mode.RANGING and self._state == SessionState.INITIAL:
-            self._server._summary.phase("ranging", 0)
+            self._connection._summary.phase("ranging", 0)
             self._ptd.start()
             self._ptd.cmd("SR,V,Auto")
-            ptd_device_type = self._server._config.ptd_device_type
+            ptd_device_type = self._analyzer.config.device_type
             if ptd_device_type in MAX_RANGE_FOR_DEVICE:
-                self._ptd.cmd(f"SR,A,{MAX_RANGE_FOR_DEVICE[ptd_device_type]}")
+                amps = str(MAX_RANGE_FOR_DEVICE[ptd_device_type])
             else:
                 logging.warning(f"Unknown max range type for device {ptd_device_type}")
-                self._ptd.cmd("SR,A,Auto")
-            with common.sig:
-                time.sleep(ANALYZER_SLEEP_SECONDS)
+                amps = "Auto"
+            self._ptd.cmd(f"SR,A,{amps}")
+            self._settle_start("ranging", "Auto", amps)
             logging.info("Starting ranging mode")
             self._ptd.cmd(f"Go,1000,0,{self._id}_ranging")
             self._go_command_time = time.monotonic()
 
             self._state = SessionState.RANGING
 
-            self._server._summary.phase("ranging", 1)
+            self._connection._summary.phase("ranging", 1)
             return True
 
         if mode == Mode.TESTING and self._state == SessionState.RANGING_DONE:
-            self._server._summary.phase("testing", 0)
+            self._connection._summary.phase("testing", 0)
             self._ptd.start()
             self._ptd.cmd(f"SR,V,{self._maxVolts}")
             self._ptd.cmd(f"SR,A,{self._maxAmps}")
-            with common.sig:
-                time.sleep(ANALYZER_SLEEP_SECONDS)
+            assert self._maxVolts is not None and self._maxAmps is not None
+            self._settle_start("testing", self._maxVolts, self._maxAmps)
             logging.info("Starting testing mode")
             self._ptd.cmd(f"Go,1000,0,{self._id}_testing")
 
             self._state = SessionState.TESTING
 
-            self._server._summary.phase("testing", 1)
+            self._connection._summary.phase("testing", 1)
             return True
 
         # Unexpected state
@@ -849,12 +1609,12 @@ class Session:
         if mode == Mode.TESTING and self._state == SessionState.TESTING_DONE:
             return True
 
-        assert self._server._summary is not None
+        assert self._connection._summary is not None
 
         if mode == Mode.RANGING and self._state == SessionState.RANGING:
-            self._server._summary.phase("ranging", 2)
+            self._connection._summary.phase("ranging", 2)
         if mode == Mode.TESTING and self._state == SessionState.TESTING:
-            self._server._summary.phase("testing", 2)
+            self._connection._summary.phase("testing", 2)
 
         with common.sig:
             time.sleep(ANALYZER_SLEEP_SECONDS)
@@ -868,28 +1628,49 @@ class Session:
             test_duration = time.monotonic() - self._go_command_time
             dirname = os.path.join(self.log_dir_path, "ranging")
             os.mkdir(dirname)
-            with open(os.path.join(dirname, "spl.txt"), "w") as f:
-                f.write(
-                    read_log(self._server._config.ptd_logfile, self._id + "_ranging")
-                )
             try:
                 start_channel = 0
                 channels_amount = 0
 
-                if self._server._config.ptd_channel is not None:
-                    if self._server._config.ptd_device_type == DEVICE_TYPE_WT500:
+                if self._analyzer.config.channel is not None:
+                    if self._analyzer.config.device_type == DEVICE_TYPE_WT500:
                         start_channel = 1
-                        channels_amount = self._server._config.ptd_channel[0]
+                        channels_amount = self._analyzer.config.channel[0]
                     else:
-                        start_channel = self._server._config.ptd_channel[0]
-                        if len(self._server._config.ptd_channel) == 2:
-                            channels_amount = self._server._config.ptd_channel[1]
-
-                self._maxVolts, self._maxAmps = max_volts_amps(
-                    self._server._config.ptd_logfile,
-                    self._id + "_ranging",
-                    start_channel,
-                    channels_amount,
+                        start_channel = self._analyzer.config.channel[0]
+                        if len(self._analyzer.config.channel) == 2:
+                            channels_amount = self._analyzer.config.channel[1]
+
+                mark = self._id + "_ranging"
+                spl = os.path.join(dirname, "spl.txt")
+                writer = source_hashes.HashingWriter(spl)
+                with writer as f:
+                    lines = 0
+                    for line in self._analyzer.log.iter_lines(mark):
+                        f.write(line)
+                        lines += 1
+                live = self._ptd.samples.max_volts_amps(
+                    mark, start_channel, channels_amount, lines
+                )
+                if live is not None:
+                    self._maxVolts, self._maxAmps = live
+                else:
+                    # Decode the log lines, writing spl.txt once more.
+                    writer = source_hashes.HashingWriter(spl)
+                    with writer as f:
+                        self._maxVolts, self._maxAmps = extract_ranging_log(
+                            self._analyzer.log.iter_lines(mark),
+                            f,
+                            mark,
+                            start_channel,
+                            channels_amount,
+                        )
+                self._connection._summary.known_hash(spl, writer.hexdigest())
+                self._write_spl_bin(dirname)
+                logging.info(
+                    f"Ranging results: maxVolts={self._maxVolts}"
+                    f" maxAmps={self._maxAmps}"
+                    f" ({'PTDaemon output' if live is not None else 'log file'})"
                 )
 
             except MaxVoltsAmpsNegativeValuesError as e:
@@ -900,7 +1681,7 @@ class Session:
                 else:
                     raise
             self._go_command_time = None
-            self._server._summary.phase("ranging", 3)
+            self._connection._summary.phase("ranging", 3)
             return True
 
         if mode == Mode.TESTING and self._state == SessionState.TESTING:
@@ -908,30 +1689,97 @@ class Session:
             self._ptd.stop()
             dirname = os.path.join(self.log_dir_path, "run_1")
             os.mkdir(dirname)
-            with open(os.path.join(dirname, "spl.txt"), "w") as f:
-                f.write(
-                    read_log(self._server._config.ptd_logfile, self._id + "_testing")
+            spl = os.path.join(dirname, "spl.txt")
+            writer = source_hashes.HashingWriter(spl)
+            with writer as f:
+                f.writelines(self._analyzer.log.iter_lines(self._id + "_testing"))
+            self._connection._summary.known_hash(spl, writer.hexdigest())
+            self._write_spl_bin(dirname)
+            stats = self._ptd.samples.stats(self._id + "_testing")
+            if stats is not None and 0 in stats.channels:
+                total = stats.channels[0]
+                logging.info(
+                    f"Testing samples: {total.count}, mean {total.mean_watts:.3f} W,"
+                    f" energy {total.energy:.3f} J"
                 )
-            self._server._summary.phase("testing", 3)
+            self._connection._summary.phase("testing", 3)
             return True
 
         # Unexpected state
         return False
 
+    def _settle_start(self, phase: str, volts: str, amps: str) -> None:
+        """Let the analyzer settle before `Go`.  RR only echoes the range
+        configuration, it does not tell whether the readings are stable, and
+        PTDaemon prints no readings before `Go`.  So the wait is at least
+        ANALYZER_SLEEP_SECONDS, then RR is polled until the analyzer reports
+        the new ranges, at most ANALYZER_RANGES_TIMEOUT_SECONDS more."""
+        started = time.monotonic()
+        with common.sig:
+            time.sleep(ANALYZER_SLEEP_SECONDS)
+        deadline = time.monotonic() + ANALYZER_RANGES_TIMEOUT_SECONDS
+        while True:
+            settled = self._ptd.ranges_applied(volts, amps)
+            remaining = deadline - time.monotonic()
+            if settled or remaining <= 0:
+                break
+            with common.sig:
+                time.sleep(min(remaining, SETTLE_POLL_SECONDS))
+
+        seconds = time.monotonic() - started
+        logging.info(
+            f"Analyzer {'applied' if settled else 'did not apply'} the {phase} ranges"
+            f" in {seconds:.3f} seconds"
+        )
+        assert self._connection._summary is not None
+        self._connection._summary.settle(f"{phase}_start", seconds, settled)
+
+    def _write_spl_bin(self, dirname: str) -> None:
+        """Write spl.bin, the columnar copy of spl.txt for the analysis tools.
+        See ptd_log.ColumnFile."""
+        fname = os.path.join(dirname, "spl.bin")
+        try:
+            with open(os.path.join(dirname, "spl.txt"), "r") as f:
+                data = ptd_log.encode(ptd_log.decode(f.read(), strict=False))
+            with open(fname, "wb") as f:
+                f.write(data)
+        except Exception:
+            # Not required for the submission.
+            logging.exception(f"Could not write {fname!r}")
+            return
+        assert self._connection._summary is not None
+        self._connection._summary.known_hash(fname, hashlib.sha1(data).hexdigest())
+
     def upload(self, mode: Mode, fname: str) -> bool:
-        if mode == Mode.RANGING and self._state == SessionState.RANGING_DONE:
-            dirname = os.path.join(self.log_dir_path, "ranging")
-            return self._extract(fname, dirname)
+        dirname = self.upload_dir(mode)
+        if dirname is None:
+            return False
+        return self._extract(fname, dirname)
+
+    def upload_dir(self, mode: Mode) -> Optional[str]:
+        """Return the directory for the loadgen logs of the given mode, or None
+        if they are not expected in the current state."""
+        # The client may upload the ranging logs while the testing phase runs.
+        if mode == Mode.RANGING and self._state in (
+            SessionState.RANGING_DONE,
+            SessionState.TESTING,
+            SessionState.TESTING_DONE,
+        ):
+            return os.path.join(self.log_dir_path, "ranging")
         if mode == Mode.TESTING and self._state == SessionState.TESTING_DONE:
-            dirname = os.path.join(self.log_dir_path, "run_1")
-            return self._extract(fname, dirname)
+            return os.path.join(self.log_dir_path, "run_1")
 
         # Unexpected state
-        return False
+        return None
 
     def drop(self) -> None:
-        self._ptd.terminate()
-        self._state = SessionState.DONE
+        if self._state == SessionState.DONE:
+            return
+        try:
+            self._ptd.release()
+        finally:
+            self._state = SessionState.DONE
+            self._analyzer.release()
 
     def _extract(self, fname: str, dirname: str) -> bool:
         try:
@@ -975,6 +1823,8 @@ def main() -> None:
             config.host,
             config.port,
             server.handle_connection,
+            threaded=config.threaded,
+            proto=common.TRANSPORTS[config.transport],
         )
     except KeyboardInterrupt:
         pass
@@ -14,9 +14,11 @@
 # =============================================================================
 
 from collections import OrderedDict
-from typing import Any, Dict, List
+from concurrent.futures import ThreadPoolExecutor
+from typing import Any, Dict, List, NamedTuple, Optional, TextIO
 import hashlib
 import inspect
+import io
 import logging
 import os
 import pathlib
@@ -26,6 +28,12 @@ _source_hashes: object = None
 
 _module_name = "ptd_client_server.lib"
 
+HASH_CHUNK_SIZE = 1024 * 1024
+
+# hashlib releases the GIL while hashing large chunks, so the files are hashed
+# in parallel.
+HASH_MAX_WORKERS = min(8, os.cpu_count() or 1)
+
 
 def get() -> object:
     """Should be called after init()."""
@@ -141,16 +149,90 @@ def _sort_dict(x: Dict[str, Any]) -> "OrderedDict[str, Any]":
     return OrderedDict(sorted(x.items()))
 
 
-def hash_dir(dirname: str) -> Dict[str, str]:
+class KnownHash(NamedTuple):
+    """SHA-1 of a file computed while it was written or received.  Valid while
+    the file size and modification time are the same."""
+
+    sha1: str
+    size: int
+    mtime_ns: int
+
+    @staticmethod
+    def of(fname: str, sha1: str) -> "KnownHash":
+        """Should be called after the file is closed, and only for a file
+        written by this process, which nothing else changes after the hash is
+        computed.  For other files, the size and mtime must be taken while
+        hashing, as Proto.send_file() does."""
+        st = os.stat(fname)
+        return KnownHash(sha1, st.st_size, st.st_mtime_ns)
+
+    def matches(self, fname: str) -> bool:
+        st = os.stat(fname)
+        return self.size == st.st_size and self.mtime_ns == st.st_mtime_ns
+
+
+def hash_file(fname: str) -> str:
+    sha1 = hashlib.sha1()
+    with open(fname, "rb") as f:
+        while True:
+            chunk = f.read(HASH_CHUNK_SIZE)
+            if len(chunk) == 0:
+                break
+            sha1.update(chunk)
+    return sha1.hexdigest()
+
+
+class _HashingBuffer(io.BufferedWriter):
+    def __init__(self, raw: io.RawIOBase) -> None:
+        super().__init__(raw)
+        self.sha1 = hashlib.sha1()
+
+    def write(self, b: Any) -> int:
+        self.sha1.update(b)
+        return super().write(b)
+
+
+class HashingWriter:
+    """Same as open(fname, "w"), but computes SHA-1 of the bytes written to the
+    file, to be passed to Summary.known_hash()."""
+
+    def __init__(self, fname: str) -> None:
+        self._buffer = _HashingBuffer(io.FileIO(fname, "w"))
+        self._file = io.TextIOWrapper(self._buffer)
+
+    def __enter__(self) -> TextIO:
+        return self._file
+
+    def __exit__(self, exc_type: Any, exc_value: Any, traceback: Any) -> None:
+        self._file.close()
+
+    def hexdigest(self) -> str:
+        return self._buffer.sha1.hexdigest()
+
+
+def hash_dir(
+    dirname: str, known: Optional[Dict[str, KnownHash]] = None
+) -> Dict[str, str]:
+    """Return SHA-1 of each file in the directory.  known maps the normalized
+    relative paths to the hashes computed earlier; they are used instead of
+    reading the files when still valid."""
     result: Dict[str, str] = {}
+    to_hash: Dict[str, str] = {}
 
     for path, dirs, files in os.walk(dirname, topdown=True):
         relpath = os.path.relpath(path, dirname)
         if relpath == ".":
             relpath = ""
         for file in files:
-            fname = os.path.join(relpath, file)
-            with open(os.path.join(path, file), "rb") as f:
-                result[_normalize(fname)] = hashlib.sha1(f.read()).hexdigest()
+            fname = _normalize(os.path.join(relpath, file))
+            full_path = os.path.join(path, file)
+            known_hash = None if known is None else known.get(fname)
+            if known_hash is not None and known_hash.matches(full_path):
+                result[fname] = known_hash.sha1
+            else:
+                to_hash[fname] = full_path
+
+    with ThreadPoolExecutor(max_workers=HASH_MAX_WORKERS) as executor:
+        result.update(zip(to_hash.keys(), executor.map(hash_file, to_hash.values())))
 
     return _sort_dict(result)
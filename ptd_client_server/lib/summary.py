@@ -16,6 +16,7 @@
 from typing import Any, List, Optional, Dict, Tuple
 import dataclasses
 import json
+import os
 import time
 import uuid
 
@@ -41,13 +42,17 @@ class Summary:
         self.timezone_offset = -time.localtime().tm_gmtoff
         self._messages: List[Any] = []
         self.ptd_messages: "Optional[PtdMessages]" = None
+        self.ptd_supervisor: Optional[Dict[str, int]] = None
         self._results: Optional[Dict[str, str]] = None
+        self._known_hashes: Dict[str, source_hashes.KnownHash] = {}
         self._phases: Dict[str, List[Tuple[float, float]]] = {
             "ranging": [],
             "testing": [],
         }
         self.debug = False
         self.ptd_config: Optional[Dict[str, Any]] = None
+        self._settle: Dict[str, Dict[str, Any]] = {}
+        self._logs_copy: Dict[str, Dict[str, Any]] = {}
 
         # TODO: move source_hashes into this module
         source_hashes_: Any = source_hashes.get()
@@ -76,8 +81,35 @@ class Summary:
         elif len(l) > n:
             l[n] = pair
 
+    def settle(self, name: str, seconds: float, settled: bool) -> None:
+        """Record the time the analyzer took to settle, `settled` is False if
+        it was cut off by the maximum."""
+        self._settle[name] = {"seconds": seconds, "settled": settled}
+
+    def logs_copy(self, name: str, size: int, seconds: float, method: str) -> None:
+        """Record how a loadgen log was copied into the output directory."""
+        self._logs_copy[name] = {"bytes": size, "seconds": seconds, "method": method}
+
+    def known_hash(self, fname: str, sha1: str) -> None:
+        """Record SHA-1 of a result file computed while writing or receiving
+        it, so hash_results() does not read it again."""
+        self.add_known_hash(fname, source_hashes.KnownHash.of(fname, sha1))
+
+    def add_known_hash(self, fname: str, known: source_hashes.KnownHash) -> None:
+        self._known_hashes[os.path.abspath(fname)] = known
+
     def hash_results(self, dirname: str) -> None:
-        self._results = source_hashes.hash_dir(dirname)
+        dirname_abs = os.path.abspath(dirname)
+        known = {}
+        for fname, known_hash in self._known_hashes.items():
+            try:
+                if os.path.commonpath([fname, dirname_abs]) != dirname_abs:
+                    continue
+            except ValueError:
+                continue  # different drives on Windows
+            relpath = os.path.relpath(fname, dirname_abs)
+            known[source_hashes._normalize(relpath)] = known_hash
+        self._results = source_hashes.hash_dir(dirname, known)
 
     def save(self, fname: str) -> None:
         with open(fname, "w", newline="\n") as f:
@@ -104,6 +136,12 @@ class Summary:
             result["ptd_messages"] = self.ptd_messages
         if self.ptd_config:
             result["ptd_config"] = self.ptd_config
+        if self._settle:
+            result["analyzer_settle"] = self._settle
+        if self._logs_copy:
+            result["loadgen_logs_copy"] = self._logs_copy
+        if self.ptd_supervisor is not None:
+            result["ptd_supervisor"] = self.ptd_supervisor
         if self.debug:
             result["debug"] = True
         return result
@@ -0,0 +1,111 @@
+# Copyright 2018 The MLPerf Authors. All Rights Reserved.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+# =============================================================================
+
+from pathlib import Path
+from typing import List, Tuple, cast
+import hashlib
+import os
+import time
+
+from ptd_client_server.lib import client
+from ptd_client_server.lib import summary as summarylib
+
+
+def test_loadgen_logs_index(tmp_path: Path) -> None:
+    logs = tmp_path / "logs"
+    for run in ["run_a", "run_b", "x/run_c"]:
+        os.makedirs(logs / run)
+        (logs / run / client.LOADGEN_LOG_FILE).write_text(run)
+        (logs / run / "mlperf_log_summary.txt").write_text(run)
+    # Make everything older than the snapshot, deepest first.
+    hour_ago = time.time() - 3600
+    for path in sorted(logs.rglob("*"), key=lambda p: -len(p.parts)) + [logs]:
+        os.utime(path, (hour_ago, hour_ago))
+
+    index = client.LoadgenLogsIndex(str(logs))
+    assert index.changed_files() == []
+
+    (logs / "run_a" / client.LOADGEN_LOG_FILE).write_text("run_a again")
+    os.makedirs(logs / "x" / "run_d")
+    (logs / "x" / "run_d" / client.LOADGEN_LOG_FILE).write_text("run_d")
+    (logs / "run_b" / "mlperf_log_summary.txt").write_text("not a detail log")
+
+    assert sorted(index.changed_files()) == [
+        str(logs / "run_a" / client.LOADGEN_LOG_FILE),
+        str(logs / "x" / "run_d" / client.LOADGEN_LOG_FILE),
+    ]
+
+    missing = tmp_path / "missing"
+    index = client.LoadgenLogsIndex(str(missing))
+    os.makedirs(missing)
+    (missing / client.LOADGEN_LOG_FILE).write_text("new")
+    assert index.changed_files() == [str(missing / client.LOADGEN_LOG_FILE)]
+
+
+def test_copy_log(tmp_path: Path) -> None:
+    data = os.urandom(3 * 1024 * 1024 + 5)
+    (tmp_path / "src").write_bytes(data)
+    method, sha1 = client.copy_log(str(tmp_path / "src"), str(tmp_path / "dst"))
+    assert (tmp_path / "dst").read_bytes() == data
+    assert method in ("reflink", "copy_file_range", "stream")
+    assert sha1 == (hashlib.sha1(data).hexdigest() if method == "stream" else None)
+
+    (tmp_path / "empty").write_bytes(b"")
+    client.copy_log(str(tmp_path / "empty"), str(tmp_path / "empty_copy"))
+    assert (tmp_path / "empty_copy").read_bytes() == b""
+
+
+def test_phase_logs_background() -> None:
+    events: List[Tuple[str, str]] = []
+
+    class SlowLogs(client.PhaseLogs):
+        def _prepare(self, loadgen_logs: str, out: str) -> None:
+            events.append(("prepare", out))
+            time.sleep(0.2)
+            events.append(("prepared", out))
+
+        def _upload(self, mode: str, out: str) -> None:
+            events.append(("upload", out))
+
+    logs = SlowLogs(
+        cast(client.CommandSender, None),
+        cast(summarylib.Summary, None),
+        "session",
+        send_logs=True,
+        stream_logs=False,
+        background=True,
+    )
+    for out in ["ranging", "run_1"]:
+        logs.start_uploads()
+        events.append(("workload", out))
+        logs.wait()
+        logs.finish(out, "INDIR", out)
+        if out == "ranging":
+            assert ("prepared", "ranging") not in events  # still copying
+    logs.close()
+
+    # The next workload starts only after the logs are copied out of INDIR,
+    # the upload runs during it.
+    assert events[:3] == [
+        ("workload", "ranging"),
+        ("prepare", "ranging"),
+        ("prepared", "ranging"),
+    ]
+    assert sorted(events[3:5]) == [("upload", "ranging"), ("workload", "run_1")]
+    assert events[5:] == [
+        ("prepare", "run_1"),
+        ("prepared", "run_1"),
+        ("upload", "run_1"),
+    ]
@@ -0,0 +1,252 @@
+# Copyright 2018 The MLPerf Authors. All Rights Reserved.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+# =============================================================================
+
+from pathlib import Path
+from typing import BinaryIO, Dict, List, Optional
+import asyncio
+import hashlib
+import itertools
+import logging
+import os
+import pytest
+import socket
+import threading
+
+from ptd_client_server.lib import common
+
+
+def test_buffer_handler_per_thread(tmp_path: Path) -> None:
+    handler = common.BufferHandler()
+    handler.setFormatter(logging.Formatter("%(message)s"))
+    logger = logging.getLogger("test_buffer_handler_per_thread")
+    logger.propagate = False
+    logger.setLevel(logging.INFO)
+    logger.addHandler(handler)
+
+    started = threading.Barrier(3)
+    logged = threading.Barrier(3)
+    unattributed = threading.Barrier(3)
+
+    def run(name: str) -> None:
+        handler.start()
+        started.wait()
+        logger.info(f"{name} 1")
+        logged.wait()
+        unattributed.wait()
+        logger.info(f"{name} 2")
+        handler.stop(str(tmp_path / f"{name}.log"))
+
+    threads = [threading.Thread(target=run, args=(name,)) for name in "ab"]
+    for thread in threads:
+        thread.start()
+    started.wait()
+    logged.wait()
+    # The main thread did not call start(), its records go to all the buffers.
+    logger.info("unattributed")
+    unattributed.wait()
+    for thread in threads:
+        thread.join()
+    logger.info("not collected")
+
+    assert (tmp_path / "a.log").read_text() == "a 1\nunattributed\na 2\n"
+    assert (tmp_path / "b.log").read_text() == "b 1\nunattributed\nb 2\n"
+
+    # Stopping the buffer of another thread.
+    handler.start()
+    ident = threading.get_ident()
+    logger.info("main")
+    thread = threading.Thread(
+        target=lambda: handler.stop(str(tmp_path / "main.log"), ident)
+    )
+    thread.start()
+    thread.join()
+    logger.info("not collected")
+    assert (tmp_path / "main.log").read_text() == "main\n"
+
+    # A worker collecting into the buffer of its parent thread.
+    handler.start()
+    ident = threading.get_ident()
+    logger.info("parent")
+
+    def worker() -> None:
+        handler.start(ident)
+        logger.info("worker")
+        handler.stop()
+
+    thread = threading.Thread(target=worker)
+    thread.start()
+    thread.join()
+    handler.stop(str(tmp_path / "parent.log"))
+    assert (tmp_path / "parent.log").read_text() == "parent\nworker\n"
+
+
+def test_transports(tmp_path: Path) -> None:
+    data = os.urandom(3 * 1024 * 1024 + 17)
+    with open(tmp_path / "in.bin", "wb") as f:
+        f.write(data)
+    sha1 = hashlib.sha1(data).hexdigest()
+
+    for a_class, b_class in itertools.product(common.TRANSPORTS.values(), repeat=2):
+        a_sock, b_sock = socket.socketpair()
+        a, b = a_class(a_sock), b_class(b_sock)
+
+        def serve() -> None:
+            assert b.recv() == "hello"
+            b.send("world\r\nwith é")
+            assert b.recv_file(str(tmp_path / "out.bin")) == sha1
+            b.send("x" * 1000000)
+
+        thread = threading.Thread(target=serve)
+        thread.start()
+        assert a.command("hello") == "world"
+        assert a.recv() == "with é"
+        known = a.send_file(str(tmp_path / "in.bin"))
+        assert known is not None and known.sha1 == sha1
+        assert known.matches(str(tmp_path / "in.bin"))
+        assert a.recv() == "x" * 1000000
+        thread.join()
+        with open(tmp_path / "out.bin", "rb") as f:
+            assert f.read() == data
+
+        b._close()
+        assert a.recv() is None
+        assert a.recv() is None
+        a._close()
+
+
+def test_stream_proto_close() -> None:
+    loops: List[asyncio.AbstractEventLoop] = []
+
+    def cycle() -> None:
+        a_sock, b_sock = socket.socketpair()
+        with common.StreamProto(a_sock) as a, common.StreamProto(b_sock) as b:
+            assert a._loop is not None and b._loop is not None
+            loops.extend([a._loop, b._loop])
+            a.send("hello")
+            assert b.recv() == "hello"
+
+        # The peer goes away, the connection is closed by recv().
+        a_sock, b_sock = socket.socketpair()
+        a, b = common.StreamProto(a_sock), common.Proto(b_sock)
+        assert a._loop is not None
+        loops.append(a._loop)
+        b.close()
+        assert a.recv() is None
+        a.close()
+
+        # The constructor fails.
+        sock = socket.socket()
+        sock.close()
+        with pytest.raises(OSError):
+            common.StreamProto(sock)
+
+    def open_fds() -> Optional[int]:
+        if not os.path.isdir("/proc/self/fd"):
+            return None
+        return len(os.listdir("/proc/self/fd"))
+
+    cycle()
+    before = open_fds()
+    for _ in range(50):
+        cycle()
+    assert open_fds() == before
+    assert all(loop.is_closed() for loop in loops)
+
+
+def test_send_file_changed(tmp_path: Path) -> None:
+    fname = str(tmp_path / "in.bin")
+    with open(fname, "wb") as f:
+        f.write(b"a" * (common.FILE_CHUNK_SIZE + 10))
+
+    class ChangingProto(common.Proto):
+        def _send_file_chunk(self, f: BinaryIO, offset: int, count: int) -> int:
+            # Rewrite the file in place after its chunk is hashed.
+            with open(fname, "r+b") as g:
+                g.write(b"b")
+            st = os.stat(fname)
+            os.utime(fname, ns=(st.st_atime_ns, st.st_mtime_ns + 10 ** 9))
+            return super()._send_file_chunk(f, offset, count)
+
+    a_sock, b_sock = socket.socketpair()
+    a, b = ChangingProto(a_sock), common.Proto(b_sock)
+    errors: List[Exception] = []
+
+    def serve() -> None:
+        try:
+            b.recv_file(str(tmp_path / "out.bin"))
+        except Exception as e:
+            errors.append(e)
+
+    thread = threading.Thread(target=serve)
+    thread.start()
+    with pytest.raises(Exception, match="changed while sending"):
+        a.send_file(fname)
+    thread.join()
+    # The receiver does not get the end of the file.
+    assert len(errors) == 1
+    assert not (tmp_path / "out.bin").exists()
+    b._close()
+
+
+def test_send_dir(tmp_path: Path) -> None:
+    src = tmp_path / "src"
+    os.makedirs(src / "sub")
+    files = {
+        "mlperf_log_detail.txt": b":::MLLOG line\n" * 300000,
+        "empty.txt": b"",
+        "sub/random.bin": os.urandom(2 * 1024 * 1024 + 3),
+    }
+    for name, data in files.items():
+        with open(src / name, "wb") as f:
+            f.write(data)
+    sha1s = {name: hashlib.sha1(data).hexdigest() for name, data in files.items()}
+
+    for a_class, b_class in itertools.product(common.TRANSPORTS.values(), repeat=2):
+        dst = tmp_path / f"dst_{a_class.__name__}_{b_class.__name__}"
+        a_sock, b_sock = socket.socketpair()
+        a, b = a_class(a_sock), b_class(b_sock)
+
+        sent: Dict[str, str] = {}
+        thread = threading.Thread(target=lambda: sent.update(a.send_dir(str(src))))
+        thread.start()
+        received = b.recv_dir(str(dst))
+        thread.join()
+        assert received == sent == sha1s
+        for name, data in files.items():
+            with open(dst / name, "rb") as f:
+                assert f.read() == data
+
+        # Discarding keeps the connection usable.
+        thread = threading.Thread(target=lambda: (a.send_dir(str(src)), a.send("x")))
+        thread.start()
+        assert b.recv_dir(None) == {}
+        assert b.recv() == "x"
+        thread.join()
+        a._close()
+        b._close()
+
+
+def test_recv_dir_unsafe_path(tmp_path: Path) -> None:
+    assert common.safe_join("d", "a/b.txt") == os.path.join("d", "a", "b.txt")
+    for relpath in ["", "/etc/passwd", "../x", "a/../../x", "a//b", "./a", "C:x"]:
+        assert common.safe_join("d", relpath) is None, relpath
+        a_sock, b_sock = socket.socketpair()
+        a, b = common.Proto(a_sock), common.Proto(b_sock)
+        a.send(f"file,{relpath}")
+        with pytest.raises(ValueError):
+            b.recv_dir(str(tmp_path))
+        assert b.recv() is None
+        a._close()
+    assert os.listdir(tmp_path) == []
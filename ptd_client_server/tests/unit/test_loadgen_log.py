@@ -0,0 +1,55 @@
+# Copyright 2018 The MLPerf Authors. All Rights Reserved.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+# =============================================================================
+
+from pathlib import Path
+import datetime
+
+from ptd_client_server.lib import loadgen_log
+
+
+def record(key: str, value: str) -> str:
+    return (
+        f':::MLLOG {{"key": "{key}", "value": "{value}", "time_ms": 1.0, '
+        f'"namespace": "mlperf::logging", "event_type": "POINT_IN_TIME"}}\n'
+    )
+
+
+def timestamp(value: str) -> float:
+    t = datetime.datetime.strptime(value, "%m-%d-%Y %H:%M:%S.%f")
+    return t.replace(tzinfo=datetime.timezone.utc).timestamp()
+
+
+def test_power_times(tmp_path: Path) -> None:
+    begin, end = "01-22-2021 15:05:14.313", "01-22-2021 15:06:14.999"
+    log = tmp_path / "mlperf_log_detail.txt"
+
+    log.write_text(
+        record("requested_power_begin_delay", "10")
+        + record("power_begin", begin)
+        + record("result_validity", "VALID") * 1000
+        + record("power_end", "broken")
+        + record("power_end", end)
+        + record("power_end_latency", "01-22-2021 15:07:00.000")
+    )
+    assert loadgen_log.power_times(str(log), 3600) == (
+        timestamp(begin) + 3600,
+        timestamp(end) + 3600,
+    )
+
+    log.write_text(f"power_begin: {begin}\r\n" + record("power_begin", end))
+    assert loadgen_log.power_times(str(log), 0) == (timestamp(begin), None)
+
+    log.write_text("")
+    assert loadgen_log.power_times(str(log), 0) == (None, None)
@@ -0,0 +1,136 @@
+# Copyright 2018 The MLPerf Authors. All Rights Reserved.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+# =============================================================================
+
+from pathlib import Path
+import datetime
+import math
+import pytest
+
+from ptd_client_server.lib import ptd_log
+from ptd_client_server.tests.unit.test_server import LOG
+
+
+def test_parse_time() -> None:
+    for value in ["01-22-2021 15:05:14.313", "12-31-1999 23:59:59.999999"]:
+        expected = datetime.datetime.strptime(value, "%m-%d-%Y %H:%M:%S.%f")
+        expected = expected.replace(tzinfo=datetime.timezone.utc)
+        epoch = datetime.datetime(1970, 1, 1, tzinfo=datetime.timezone.utc)
+        microseconds = (expected - epoch) // datetime.timedelta(microseconds=1)
+        assert ptd_log.parse_time(value) == microseconds * 1000
+    assert ptd_log.parse_time("01-01-1970 00:00:01") == 10 ** 9
+    with pytest.raises(ValueError):
+        ptd_log.parse_time("2021-01-22 15:05:14.313")
+    with pytest.raises(ValueError):
+        ptd_log.parse_time("01-22-2021 25:05:14.313")
+
+
+def test_split() -> None:
+    line = LOG.decode().splitlines()[-2]
+    words = ptd_log.split(line)
+    groups = ptd_log.channel_groups(len(words))
+    assert [words[i] for i in groups] == ["Ch1", "Ch2", "Ch3"]
+    with pytest.raises(ptd_log.LitNotFoundError) as excinfo:
+        ptd_log.split(LOG.decode().splitlines()[-1])
+    assert "Expected 'Watts', got 'Watts1'" in str(excinfo.value)
+    with pytest.raises(ptd_log.LitNotFoundError):
+        ptd_log.split(line + ",Ch4,Watts")
+
+
+def test_decode() -> None:
+    with pytest.raises(ptd_log.LitNotFoundError) as excinfo:
+        ptd_log.decode(LOG.decode())
+    assert "Expected 'Watts', got 'Watts1'" in str(excinfo.value)
+
+    samples = ptd_log.decode(LOG.decode().replace("\n", "\r\n"), strict=False)
+    assert samples.rows == 7
+    assert samples.marks == ["2021-01-22_15-05-02_loadgen_ranging", "notset"]
+    assert list(samples.mark) == [0, 0, 0, 0, 1, 1, 1]
+    assert samples.time_ns[1] - samples.time_ns[0] == 1009 * 10 ** 6
+    assert sorted(samples.channels) == [0, 1, 2, 3]
+    assert list(samples.channels[0].watts[:2]) == [22.97, 25.65]
+    # The channels are missing in the lines of the single channel analyzer.
+    assert all(math.isnan(x) for x in samples.channels[3].amps[:4])
+    assert list(samples.channels[3].amps[4:]) == [0.802, 0.8103, 0.8102]
+    assert samples.channels[0].volts_text is None
+
+
+def test_decode_layouts() -> None:
+    line = (
+        "Time,01-22-2021 15:05:14.313,Watts,22.970000,Volts,227.370000,"
+        "Amps,0.204340,PF,0.494400,Mark,m"
+    )
+    ch1 = ",Ch1,Watts,1.0,Volts,2.0,Amps,3.0,PF,4.0"
+    ch2 = ch1.replace("Ch1", "Ch2")
+    data = "\n".join([line + ch1, line + ch2, line + ch2, line + ch1 + ch2, "x"])
+
+    blocks = list(ptd_log.tokenize(data))
+    assert [(b.rows, b.channels) for b in blocks] == [(1, (1,)), (2, (2,)), (1, (1, 2))]
+
+    samples = ptd_log.decode(data, keep_text=True)
+    assert samples.rows == 4
+    assert [math.isnan(x) for x in samples.channels[1].watts] == [
+        False,
+        True,
+        True,
+        False,
+    ]
+    assert samples.channels[2].amps_text == ["nan", "3.0", "3.0", "3.0"]
+    with pytest.raises(ptd_log.ExtraChannelError):
+        samples.check_channels(2, 1)  # missing in the first line
+    with pytest.raises(ptd_log.ExtraChannelError):
+        samples.check_channels(1, 1)  # extra in the log
+
+    samples = ptd_log.decode(data[len(line + ch1) :], keep_text=True)
+    samples.check_channels(2, 1)
+    assert samples.max_volts_amps(2, 1) == ("227.370000", "3.0")
+
+    assert list(ptd_log.tokenize("")) == []
+
+
+def test_column_file(tmp_path: Path) -> None:
+    samples = ptd_log.decode(LOG.decode(), strict=False)
+    with open(tmp_path / "spl.bin", "wb") as f:
+        f.write(ptd_log.encode(samples))
+
+    with ptd_log.ColumnFile(str(tmp_path / "spl.bin")) as f:
+        assert f.rows == 7
+        assert f.marks == samples.marks
+        assert f.channels == [0, 1, 2, 3]
+        assert list(f.column("time_ns")) == list(samples.time_ns)
+        assert list(f.column("mark")) == list(samples.mark)
+        for ch in f.channels:
+            for name in ptd_log.FIELDS:
+                expected = getattr(samples.channels[ch], name)
+                actual = f.column(name, ch)
+                assert len(actual) == len(expected)
+                for x, y in zip(actual, expected):
+                    assert x == y or (math.isnan(x) and math.isnan(y))
+
+    with open(tmp_path / "empty.bin", "wb") as f:
+        f.write(ptd_log.encode(ptd_log.decode("")))
+    with ptd_log.ColumnFile(str(tmp_path / "empty.bin")) as f:
+        assert f.rows == 0
+        assert f.channels == []
+        assert list(f.column("time_ns")) == []
+
+    data = (tmp_path / "spl.bin").read_bytes()
+    for bad in [data[:-8], b"", b"Time,"]:
+        with open(tmp_path / "bad.bin", "wb") as f:
+            f.write(bad)
+        with pytest.raises(ValueError):
+            ptd_log.ColumnFile(str(tmp_path / "bad.bin"))
+
+    with pytest.raises(ValueError):
+        ptd_log.encode(ptd_log.decode(LOG.decode(), strict=False, times=False))
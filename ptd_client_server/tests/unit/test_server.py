@@ -14,9 +14,15 @@
 # =============================================================================
 
 from pathlib import Path
+from typing import Any, List, Tuple, cast
+import io
+import os
 import pytest
 import socket
+import threading
+import time
 
+from ptd_client_server.lib import common
 from ptd_client_server.lib import server
 
 
@@ -49,21 +55,24 @@ def test_tcp_port_is_occupied() -> None:
         assert server.tcp_port_is_occupied(9999) is False
 
 
+LOG = (
+    b"Time,11-07-2020 17:49:06.145,NOTICE,Analyzer identity response of 32 bytes: YOKOGAWA,WT310,C2PH13047V,F1.03\n"
+    b"Time,11-07-2020 17:54:49.071,ERROR,Bad volts reading nan from WT310\n"
+    b"Buffer was 1.000E+00;1;300.0E+00;1\n"
+    b"Time,01-22-2021 15:05:14.313,Watts,22.970000,Volts,227.370000,Amps,0.204340,PF,0.494400,Mark,2021-01-22_15-05-02_loadgen_ranging\n"
+    b"Time,01-22-2021 15:05:15.322,Watts,25.650000,Volts,227.370000,Amps,0.225410,PF,0.500600,Mark,2021-01-22_15-05-02_loadgen_ranging\n"
+    b"Time,01-22-2021 15:05:15.322,Watts,25.650000,Volts,227.370000,Amps,0.225410,PF,0.500600,Mark,2021-01-22_15-05-02_loadgen_ranging\n"
+    b"Time,01-22-2021 15:05:15.322,Watts,25.650000,Volts,227.370000,Amps,0.225410,PF,0.500600,Mark,2021-01-22_15-05-02_loadgen_ranging\n"
+    b"Time,11-13-2020 22:38:59.240,Watts,272.930000,Volts,-1.000000,Amps,-1.000000,PF,-1.000000,Mark,notset,Ch1,Watts,91.060000,Volts,120.950000,Amps,0.832100,PF,0.938900,Ch2,Watts,90.970000,Volts,120.830000,Amps,0.802000,PF,0.938800,Ch3,Watts,90.900000,Volts,120.750000,Amps,0.802000,PF,0.938700\n"
+    b"Time,11-13-2020 22:39:00.239,Watts,275.630000,Volts,-1.000000,Amps,-1.000000,PF,-1.000000,Mark,notset,Ch1,Watts,91.960000,Volts,120.910000,Amps,0.810300,PF,0.938600,Ch2,Watts,91.870000,Volts,120.850000,Amps,0.810200,PF,0.938500,Ch3,Watts,91.800000,Volts,120.740000,Amps,0.810300,PF,0.938400\n"
+    b"Time,11-13-2020 22:39:00.239,Watts,275.630000,Volts,-1.000000,Amps,-1.000000,PF,-1.000000,Mark,notset,Ch1,Watts,91.960000,Volts,120.910000,Amps,0.810300,PF,0.938600,Ch2,Watts,91.870000,Volts,120.830000,Amps,0.810400,PF,0.938500,Ch3,Watts,91.800000,Volts,120.730000,Amps,0.810200,PF,0.938400\n"
+    b"Time,11-13-2020 22:39:00.239,Watts,275.630000,Volts,-1.000000,Amps,-1.000000,PF,-1.000000,Mark,notset1,Ch1,Watts1,91.960000,Volts,120.910000,Amps,0.810300,PF,0.938600,Ch2,Watts,91.870000,Volts,120.830000,Amps,0.810400,PF,0.938500,Ch3,Watts,91.800000,Volts,120.730000,Amps,0.810200,PF,0.938400\n"
+)
+
+
 def test_max_volts_amps(tmp_path: Path) -> None:
     with open(tmp_path / "logs_tmp", "wb") as f:
-        f.write(
-            b"Time,11-07-2020 17:49:06.145,NOTICE,Analyzer identity response of 32 bytes: YOKOGAWA,WT310,C2PH13047V,F1.03\n"
-            b"Time,11-07-2020 17:54:49.071,ERROR,Bad volts reading nan from WT310\n"
-            b"Buffer was 1.000E+00;1;300.0E+00;1\n"
-            b"Time,01-22-2021 15:05:14.313,Watts,22.970000,Volts,227.370000,Amps,0.204340,PF,0.494400,Mark,2021-01-22_15-05-02_loadgen_ranging\n"
-            b"Time,01-22-2021 15:05:15.322,Watts,25.650000,Volts,227.370000,Amps,0.225410,PF,0.500600,Mark,2021-01-22_15-05-02_loadgen_ranging\n"
-            b"Time,01-22-2021 15:05:15.322,Watts,25.650000,Volts,227.370000,Amps,0.225410,PF,0.500600,Mark,2021-01-22_15-05-02_loadgen_ranging\n"
-            b"Time,01-22-2021 15:05:15.322,Watts,25.650000,Volts,227.370000,Amps,0.225410,PF,0.500600,Mark,2021-01-22_15-05-02_loadgen_ranging\n"
-            b"Time,11-13-2020 22:38:59.240,Watts,272.930000,Volts,-1.000000,Amps,-1.000000,PF,-1.000000,Mark,notset,Ch1,Watts,91.060000,Volts,120.950000,Amps,0.832100,PF,0.938900,Ch2,Watts,90.970000,Volts,120.830000,Amps,0.802000,PF,0.938800,Ch3,Watts,90.900000,Volts,120.750000,Amps,0.802000,PF,0.938700\n"
-            b"Time,11-13-2020 22:39:00.239,Watts,275.630000,Volts,-1.000000,Amps,-1.000000,PF,-1.000000,Mark,notset,Ch1,Watts,91.960000,Volts,120.910000,Amps,0.810300,PF,0.938600,Ch2,Watts,91.870000,Volts,120.850000,Amps,0.810200,PF,0.938500,Ch3,Watts,91.800000,Volts,120.740000,Amps,0.810300,PF,0.938400\n"
-            b"Time,11-13-2020 22:39:00.239,Watts,275.630000,Volts,-1.000000,Amps,-1.000000,PF,-1.000000,Mark,notset,Ch1,Watts,91.960000,Volts,120.910000,Amps,0.810300,PF,0.938600,Ch2,Watts,91.870000,Volts,120.830000,Amps,0.810400,PF,0.938500,Ch3,Watts,91.800000,Volts,120.730000,Amps,0.810200,PF,0.938400\n"
-            b"Time,11-13-2020 22:39:00.239,Watts,275.630000,Volts,-1.000000,Amps,-1.000000,PF,-1.000000,Mark,notset1,Ch1,Watts1,91.960000,Volts,120.910000,Amps,0.810300,PF,0.938600,Ch2,Watts,91.870000,Volts,120.830000,Amps,0.810400,PF,0.938500,Ch3,Watts,91.800000,Volts,120.730000,Amps,0.810200,PF,0.938400\n"
-        )
+        f.write(LOG)
 
     assert server.max_volts_amps(str(tmp_path / "logs_tmp"), "notset", 3, 1) == (
         "120.750000",
@@ -92,3 +101,423 @@ def test_max_volts_amps(tmp_path: Path) -> None:
     with pytest.raises(server.LitNotFoundError) as excinfo:
         server.max_volts_amps(str(tmp_path / "logs_tmp"), "notset1", 1, 3)
     assert "Expected 'Watts', got 'Watts1'" in str(excinfo.value)
+
+
+def test_ptd_log_index(tmp_path: Path) -> None:
+    fname = str(tmp_path / "logs_tmp")
+    line_r = (
+        "Time,01-22-2021 15:05:14.313,Watts,22.970000,Volts,227.370000,"
+        "Amps,0.204340,PF,0.494400,Mark,s_ranging\n"
+    )
+    line_t = line_r.replace("s_ranging", "s_testing")
+    with open(fname, "w") as f:
+        f.write("Time,11-07-2020 17:54:49.071,ERROR,Bad volts reading\n")
+        f.write(line_r * 2)
+
+    index = server.PtdLogIndex(fname)
+    assert index.read("s_ranging") == [line_r] * 2
+    assert index.read("s_testing") == []
+
+    with open(fname, "a") as f:
+        f.write(line_r + line_t + line_t[:20])
+    assert index.read("s_ranging") == [line_r] * 3
+    assert index.read("s_testing") == [line_t]
+
+    with open(fname, "a") as f:
+        f.write(line_t[20:])
+    assert index.read("s_testing") == [line_t] * 2
+
+    # PTDaemon started over with a fresh log file
+    with open(fname, "w") as f:
+        f.write(line_t)
+    assert index.read("s_ranging") == []
+    assert index.read("s_testing") == [line_t]
+
+
+def test_extract_ranging_log(tmp_path: Path) -> None:
+    with open(tmp_path / "logs_tmp", "wb") as f:
+        f.write(LOG)
+
+    def extract(mark: str, start_channel: int, amount_of_channels: int) -> Any:
+        out = io.StringIO()
+        with open(tmp_path / "logs_tmp", "r") as f:
+            result = server.extract_ranging_log(
+                f, out, mark, start_channel, amount_of_channels
+            )
+        assert out.getvalue() == server.read_log(str(tmp_path / "logs_tmp"), mark)
+        return result
+
+    for mark, start_channel, amount_of_channels in [
+        ("notset", 3, 1),
+        ("notset", 2, 2),
+        ("notset", 1, 3),
+        ("2021-01-22_15-05-02_loadgen_ranging", 0, 0),
+        ("2021-01-22_15-05-02_loadgen_ranging", 1, 0),
+    ]:
+        expected = server.max_volts_amps(
+            str(tmp_path / "logs_tmp"), mark, start_channel, amount_of_channels
+        )
+        assert extract(mark, start_channel, amount_of_channels) == expected
+
+    with pytest.raises(server.ExtraChannelError):
+        extract("notset", 2, 4)
+    with pytest.raises(server.LitNotFoundError) as excinfo:
+        extract("notset1", 1, 3)
+    assert "Expected 'Watts', got 'Watts1'" in str(excinfo.value)
+    with pytest.raises(server.MaxVoltsAmpsNegativeValuesError):
+        extract("unknown", 0, 0)
+
+
+def test_sample_aggregator(tmp_path: Path) -> None:
+    with open(tmp_path / "logs_tmp", "wb") as f:
+        f.write(LOG)
+
+    def lines(mark: str) -> int:
+        return server.read_log(str(tmp_path / "logs_tmp"), mark).count("\n")
+
+    samples = server.SampleAggregator()
+    text = LOG.decode()
+    # Chunks split in the middle of lines, with a prefix before each sample.
+    text = text.replace("Time,01-22-2021", "01-22-2021 15:05:15.000: Time,01-22-2021")
+    for i in range(0, len(text), 100):
+        samples.feed(text[i : i + 100])
+
+    for mark, start_channel, amount_of_channels in [
+        ("notset", 3, 1),
+        ("notset", 2, 2),
+        ("notset", 1, 3),
+        ("2021-01-22_15-05-02_loadgen_ranging", 0, 0),
+        ("2021-01-22_15-05-02_loadgen_ranging", 1, 0),
+    ]:
+        expected = server.max_volts_amps(
+            str(tmp_path / "logs_tmp"), mark, start_channel, amount_of_channels
+        )
+        assert (
+            samples.max_volts_amps(
+                mark, start_channel, amount_of_channels, lines(mark)
+            )
+            == expected
+        )
+
+    # Cases where the log file should be used instead.
+    assert samples.max_volts_amps("notset", 3, 1, lines("notset") + 1) is None
+    assert samples.max_volts_amps("notset", 2, 4, lines("notset")) is None
+    assert samples.max_volts_amps("notset", 1, 1, lines("notset")) is None
+    assert samples.max_volts_amps("notset1", 1, 3, lines("notset1")) is None
+    assert samples.max_volts_amps("unknown", 0, 0, 0) is None
+
+    stats = samples.stats("2021-01-22_15-05-02_loadgen_ranging")
+    assert stats is not None
+    total = stats.channels[0]
+    assert total.count == 4
+    assert total.min_watts == 22.97
+    assert total.max_watts == 25.65
+    assert abs(total.mean_watts - (22.97 + 3 * 25.65) / 4) < 1e-9
+    assert abs(total.energy - 22.97 * 1.009) < 1e-4
+
+
+def test_ptd_ranges_polls_not_recorded(tmp_path: Path) -> None:
+    fixed, auto = "Ranges,0,20.0,1,-1.0", "Ranges,1,-1.0,1,-1.0"
+
+    class FakeProto:
+        def __init__(self) -> None:
+            self.replies = [fixed, fixed, fixed, fixed, auto]
+
+        def send(self, cmd: str) -> None:
+            assert cmd == "RR"
+
+        def recv(self) -> str:
+            return self.replies.pop(0)
+
+    class FakeProcess:
+        def poll(self) -> None:
+            return None
+
+    ptd = server.Ptd(["ptd"], 18888, str(tmp_path))
+    ptd._proto = cast(common.Proto, FakeProto())
+    ptd._process = cast(Any, FakeProcess())
+    try:
+        assert ptd.cmd("RR") == fixed
+        assert ptd.ranges_applied("Auto", "20")
+        assert ptd.ranges_applied("Auto", "10")
+        assert not ptd.ranges_applied("Auto", "Auto")
+        assert ptd.ranges_applied("Auto", "Auto")
+    finally:
+        ptd._process = None
+    # Only the RR sent with cmd() goes to ptd_messages.
+    assert ptd._messages.to_json() == [{"cmd": "RR", "reply": fixed}]
+
+
+def test_settle_start(monkeypatch: Any) -> None:
+    monkeypatch.setattr(server, "ANALYZER_SLEEP_SECONDS", 0.3)
+    monkeypatch.setattr(server, "ANALYZER_RANGES_TIMEOUT_SECONDS", 0.3)
+    monkeypatch.setattr(server, "SETTLE_POLL_SECONDS", 0.05)
+    settles: List[Tuple[str, float, bool]] = []
+
+    class FakeSummary:
+        def settle(self, name: str, seconds: float, settled: bool) -> None:
+            settles.append((name, seconds, settled))
+
+    class FakeConnection:
+        _summary = FakeSummary()
+
+    class FakePtd:
+        def __init__(self, applied: bool) -> None:
+            self.applied = applied
+            self.polls = 0
+
+        def ranges_applied(self, volts: str, amps: str) -> bool:
+            self.polls += 1
+            return self.applied
+
+    class FakeSession:
+        def __init__(self, applied: bool) -> None:
+            self._ptd = FakePtd(applied)
+            self._connection = FakeConnection()
+
+    # RR reports the ranges at once, but the readings need time to settle.
+    session = FakeSession(True)
+    server.Session._settle_start(cast(server.Session, session), "ranging", "Auto", "20")
+    assert session._ptd.polls == 1
+    assert settles[-1][0] == "ranging_start" and settles[-1][2]
+    assert settles[-1][1] >= 0.3
+
+    # The analyzer never reports the ranges.
+    session = FakeSession(False)
+    server.Session._settle_start(cast(server.Session, session), "testing", "230", "2")
+    assert session._ptd.polls > 1
+    assert settles[-1][0] == "testing_start" and not settles[-1][2]
+    assert settles[-1][1] >= 0.6
+
+
+def test_ptd_failure(tmp_path: Path) -> None:
+    class FakeProto:
+        def send(self, cmd: str) -> None:
+            pass
+
+        def recv(self) -> None:
+            return None
+
+    class FakeProcess:
+        terminated = False
+
+        def poll(self) -> None:
+            return None
+
+        def terminate(self) -> None:
+            self.terminated = True
+
+        def wait(self, timeout: float) -> None:
+            pass
+
+    process = FakeProcess()
+    ptd = server.Ptd(["ptd"], 18888, str(tmp_path), keep_running=True)
+    ptd._proto = cast(common.Proto, FakeProto())
+    ptd._process = cast(Any, process)
+    # Not SystemExit: only the session using this PTDaemon is ended.
+    with pytest.raises(server.PtdError, match="no reply"):
+        ptd.cmd("Go,1000,0,x")
+    assert ptd._proto is None
+    # A PTDaemon which stopped replying is not kept for the next session.
+    ptd.release()
+    assert process.terminated and ptd._process is None
+
+
+def test_tee_redirect(tmp_path: Path) -> None:
+    def write(data: bytes) -> None:
+        os.write(tee.w, data)
+        tee.settle()
+
+    uncertainty = (
+        b"01-22-2021 15:04:50.000: Uncertainty checking for Yokogawa WT310 is"
+        b" activated\n"
+    )
+    banner = (
+        b"PTDaemon starting\n"
+        + uncertainty
+        + b"01-22-2021 15:04:51.000: ERROR: startup error of session a\n"
+    )
+    samples = server.SampleAggregator()
+    tee = server.Tee(str(tmp_path / "a.txt"), samples, banner=True)
+    write(banner)
+    tee.mark_banner()
+    write(LOG)
+    write(b"01-22-2021 15:06:00.000: ERROR: session a\n")
+    tee.redirect(None, None)
+    write(b"between sessions\n")
+    samples_b = server.SampleAggregator()
+    tee.redirect(str(tmp_path / "b.txt"), samples_b)
+    write(b"session b\n")
+    tee.redirect(None, None)
+    tee.redirect(str(tmp_path / "c.txt"), None)
+    write(b"session c\n")
+    tee.done()
+
+    assert (tmp_path / "a.txt").read_bytes() == (
+        banner + LOG + b"01-22-2021 15:06:00.000: ERROR: session a\n"
+    )
+    # The later sessions get only their own output and the uncertainty line.
+    replayed = server.PTD_BANNER_BEGIN + uncertainty + server.PTD_BANNER_END
+    assert (tmp_path / "b.txt").read_bytes() == replayed + b"session b\n"
+    assert (tmp_path / "c.txt").read_bytes() == replayed + b"session c\n"
+    assert samples.stats("2021-01-22_15-05-02_loadgen_ranging") is not None
+    assert samples_b.stats("2021-01-22_15-05-02_loadgen_ranging") is None
+
+
+def test_tee_output_events(tmp_path: Path) -> None:
+    tee = server.Tee(str(tmp_path / "ptd_logs.txt"))
+    assert tee.wait_output(0, 0.01) == 0
+    os.write(tee.w, b"Listening\n")
+    assert tee.wait_output(0, 10) == 1
+    assert not tee.eof()
+    tee.done()
+    assert tee.eof()
+    assert tee.wait_output(1, 10) == 1
+    assert (tmp_path / "ptd_logs.txt").read_bytes() == b"Listening\n"
+
+
+def test_server_config_analyzers(tmp_path: Path) -> None:
+    def write_config(extra: str) -> str:
+        with open(tmp_path / "server.conf", "w") as f:
+            f.write(
+                "[server]\n"
+                "ntpServer: ntp.example.com\n"
+                f"outDir: {tmp_path}\n"
+                "[ptd]\n"
+                "ptd: ptd\n"
+                f"logFile: {tmp_path / 'ptd.txt'}\n"
+                "networkPort: 18888\n"
+                "deviceType: 49\n"
+                "interfaceFlag:\n"
+                "devicePort: COM1\n" + extra
+            )
+        return str(tmp_path / "server.conf")
+
+    config = server.ServerConfig(write_config(""))
+    assert list(config.analyzers) == [""]
+    assert config.threaded is False
+    assert config.analyzers[""].port == 18888
+    assert config.analyzers[""].keep_running is False
+
+    config = server.ServerConfig(
+        write_config(
+            "[ptd.rack2]\n"
+            "ptd: ptd\n"
+            f"logFile: {tmp_path / 'ptd2.txt'}\n"
+            "networkPort: 18889\n"
+            "deviceType: 77\n"
+            "channel: 1,2\n"
+            "interfaceFlag: -y\n"
+            "devicePort: C2PH13047V\n"
+            "keepRunning: yes\n"
+        )
+    )
+    assert list(config.analyzers) == ["", "rack2"]
+    assert config.threaded is True
+    rack2 = config.analyzers["rack2"]
+    assert rack2.section == "ptd.rack2"
+    assert rack2.keep_running is True
+    assert rack2.command == [
+        "ptd",
+        "-l",
+        str(tmp_path / "ptd2.txt"),
+        "-p",
+        "18889",
+        "-c",
+        "1,2",
+        "-y",
+        "77",
+        "C2PH13047V",
+    ]
+
+    with pytest.raises(SystemExit):
+        server.ServerConfig(
+            write_config(
+                "[ptd.rack2]\n"
+                "ptd: ptd\n"
+                f"logFile: {tmp_path / 'ptd2.txt'}\n"
+                "networkPort: 18888\n"
+                "deviceType: 49\n"
+                "interfaceFlag:\n"
+                "devicePort: COM2\n"
+            )
+        )
+
+
+def server_config(tmp_path: Path) -> server.ServerConfig:
+    with open(tmp_path / "server.conf", "w") as f:
+        f.write(
+            "[server]\n"
+            "ntpServer: ntp.example.com\n"
+            f"outDir: {tmp_path}\n"
+            "[ptd]\n"
+            "ptd: ptd\n"
+            f"logFile: {tmp_path / 'ptd.txt'}\n"
+            "networkPort: 18888\n"
+            "deviceType: 49\n"
+            "interfaceFlag:\n"
+            "devicePort: COM1\n"
+        )
+    return server.ServerConfig(str(tmp_path / "server.conf"))
+
+
+def test_server_stop_waits_for_connections(tmp_path: Path, monkeypatch: Any) -> None:
+    config = server_config(tmp_path)
+    release = threading.Event()
+    handled: List[str] = []
+
+    class FakeConnection:
+        def __init__(self, srv: server.Server) -> None:
+            self._server = srv
+
+        def handle(self, p: str) -> None:
+            handled.append(p)
+            if p == "stop":
+                self._server._stop = True
+            else:
+                release.wait()
+
+    monkeypatch.setattr(server, "Connection", FakeConnection)
+    srv = server.Server(config)
+    exits: List[str] = []
+
+    def handle(name: str) -> None:
+        try:
+            srv.handle_connection(cast(common.Proto, name))
+        except SystemExit:
+            exits.append(name)
+
+    other = threading.Thread(target=handle, args=("session",))
+    other.start()
+    while not handled:
+        time.sleep(0.01)
+
+    # The stop request does not end the session of the other connection.
+    handle("stop")
+    assert exits == []
+    # The new connections are refused while stopping.
+    handle("late")
+    assert handled == ["session", "stop"]
+
+    release.set()
+    other.join()
+    assert exits == ["session"]
+
+
+def test_server_set_ntp(tmp_path: Path, monkeypatch: Any) -> None:
+    calls: List[str] = []
+    monkeypatch.setattr(server.time_sync, "set_ntp", calls.append)
+    srv = server.Server(server_config(tmp_path))
+    connection, other = server.Connection(srv), server.Connection(srv)
+    srv._connections.update([connection, other])
+
+    # Stepping the clock would break the timestamps of the other session.
+    other.session = cast(server.Session, object())
+    assert connection._handle_cmd("set_ntp", cast(common.Proto, None)) == (
+        "Error: other sessions are active"
+    )
+    assert calls == []
+
+    other.session = None
+    assert connection._handle_cmd("set_ntp", cast(common.Proto, None)) == "OK"
+    assert calls == ["ntp.example.com"]
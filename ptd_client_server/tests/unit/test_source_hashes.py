@@ -14,12 +14,15 @@
 # =============================================================================
 
 from pathlib import Path
+import hashlib
 import json
 import os
 import shutil
 import subprocess
 import sys
 
+from ptd_client_server.lib import source_hashes
+
 
 def test_foo(tmp_path: Path) -> None:
     os.mkdir(tmp_path / "ptd_client_server")
@@ -73,3 +76,33 @@ def test_foo(tmp_path: Path) -> None:
     assert "modules" in parsed_result
     assert "main.py" in parsed_result["sources"]
     assert "lib/source_hashes.py" in parsed_result["sources"]
+
+
+def test_hash_dir(tmp_path: Path) -> None:
+    os.mkdir(tmp_path / "sub")
+    data = {"a.txt": b"a" * 3_000_000, "sub/b.txt": b"b", "sub/c.txt": b""}
+    for name, content in data.items():
+        with open(tmp_path / name, "wb") as f:
+            f.write(content)
+    expected = {k: hashlib.sha1(v).hexdigest() for k, v in data.items()}
+
+    assert source_hashes.hash_dir(str(tmp_path)) == expected
+
+    # A valid known hash is used as is, a stale one is ignored.
+    known = {
+        "a.txt": source_hashes.KnownHash.of(str(tmp_path / "a.txt"), "known"),
+        "sub/b.txt": source_hashes.KnownHash.of(str(tmp_path / "sub/b.txt"), "stale"),
+    }
+    with open(tmp_path / "sub/b.txt", "ab") as f:
+        f.write(b"b")
+    expected["a.txt"] = "known"
+    expected["sub/b.txt"] = hashlib.sha1(b"bb").hexdigest()
+    assert source_hashes.hash_dir(str(tmp_path), known) == expected
+
+
+def test_hashing_writer(tmp_path: Path) -> None:
+    writer = source_hashes.HashingWriter(str(tmp_path / "spl.txt"))
+    with writer as f:
+        f.writelines(f"Time:{i},Watts:1.0\n" for i in range(100000))
+    with open(tmp_path / "spl.txt", "rb") as f2:
+        assert writer.hexdigest() == hashlib.sha1(f2.read()).hexdigest()